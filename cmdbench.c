@@ -0,0 +1,246 @@
+// This file is licensed under GPLv3 <https://www.gnu.org/licenses/>
+// gcc cmdbench.c -o cmdbench -O2 -lpthread
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/resource.h>
+
+#include "cminesweeperd.h"
+
+/**
+ * Load generator for cminesweeperd.
+ *
+ *   cmdbench <socket> <connections> <threads> <seconds> [depth]
+ *
+ * Every connection plays hard boards. Each thread owns a slice of the
+ * connections and, per round, pipelines `depth` random moves down every
+ * one of them before reading any replies, so the daemon always has work
+ * queued on all of its workers. With seconds == 0 the games are started
+ * and then left idle until the process is killed, which is how we look
+ * at the daemon's memory per idle game.
+ */
+
+#define BENCH_ROWS    16
+#define BENCH_COLS    30
+#define BENCH_MINES   99
+#define MAX_DEPTH     64
+
+typedef struct bench_thread
+{
+  pthread_t thread;
+  int * fds;
+  int num_fds;
+  unsigned int seed;
+  unsigned long moves;
+  unsigned long cells;
+  unsigned long games;
+} bench_thread;
+
+// GLOBALS
+const char * socket_path;
+int depth = 8;
+volatile bool running = true;
+
+static int connect_daemon();
+static int send_request(int fd, uint8_t op, uint16_t row, uint16_t col, uint32_t mines, uint32_t seed);
+static bool read_full(int fd, void * buf, size_t len);
+static bool read_reply(int fd, cmd_response * resp, unsigned long * cells);
+static void * bench_main(void * arg);
+static double now();
+
+
+int main(int argc, char ** argv)
+{
+  if(argc < 5)
+  {
+    printf("usage: %s <socket> <connections> <threads> <seconds> [depth]\n", argv[0]);
+    exit(1);
+  }
+  socket_path = argv[1];
+  int num_conns = atoi(argv[2]);
+  int num_threads = atoi(argv[3]);
+  int seconds = atoi(argv[4]);
+  if(argc > 5) depth = atoi(argv[5]);
+  if(num_conns < 1 || num_threads < 1 || depth < 1 || depth > MAX_DEPTH)
+  {
+    printf("Bad arguments\n");
+    exit(1);
+  }
+  if(num_threads > num_conns) num_threads = num_conns;
+
+  struct rlimit lim;
+  if(getrlimit(RLIMIT_NOFILE, &lim) == 0)
+  {
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+  }
+
+  int * fds = malloc(sizeof(int) * num_conns);
+  for(int i = 0; i < num_conns; i++)
+  {
+    fds[i] = connect_daemon();
+    if(fds[i] == -1)
+    {
+      printf("Failed to connect to %s after %d connections: %s\n", socket_path, i, strerror(errno));
+      exit(1);
+    }
+
+    cmd_response resp;
+    unsigned long cells = 0;
+    if(send_request(fds[i], CMD_OP_NEW_GAME, BENCH_ROWS, BENCH_COLS, BENCH_MINES, i + 1) == -1 ||
+       !read_reply(fds[i], &resp, &cells) || resp.status != CMD_STATUS_OK)
+    {
+      printf("Failed to start game %d\n", i);
+      exit(1);
+    }
+  }
+
+  if(seconds == 0)
+  {
+    printf("%d games idle, ^C to stop\n", num_conns);
+    fflush(stdout);
+    pause();
+    return 0;
+  }
+
+  bench_thread * threads = calloc(num_threads, sizeof(bench_thread));
+  int per_thread = num_conns / num_threads;
+  for(int i = 0; i < num_threads; i++)
+  {
+    threads[i].fds = fds + i * per_thread;
+    threads[i].num_fds = i == num_threads - 1 ? num_conns - i * per_thread : per_thread;
+    threads[i].seed = i * 7919 + 1;
+  }
+
+  double start = now();
+  for(int i = 0; i < num_threads; i++)
+    pthread_create(&threads[i].thread, NULL, bench_main, &threads[i]);
+  sleep(seconds);
+  running = false;
+
+  unsigned long moves = 0, cells = 0, games = 0;
+  for(int i = 0; i < num_threads; i++)
+  {
+    pthread_join(threads[i].thread, NULL);
+    moves += threads[i].moves;
+    cells += threads[i].cells;
+    games += threads[i].games;
+  }
+  double elapsed = now() - start;
+
+  printf("%lu moves in %.2fs: %.0f moves/sec, %.1f cells/move, %lu games finished\n",
+         moves, elapsed, moves / elapsed, moves ? (double)cells / moves : 0.0, games);
+  return 0;
+}
+
+int connect_daemon()
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(fd == -1) return -1;
+  if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+  {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int send_request(int fd, uint8_t op, uint16_t row, uint16_t col, uint32_t mines, uint32_t seed)
+{
+  cmd_request req = { .op = op, .row = row, .col = col, .mines = mines, .seed = seed };
+  return write(fd, &req, sizeof(req)) == sizeof(req) ? 0 : -1;
+}
+
+bool read_full(int fd, void * buf, size_t len)
+{
+  size_t got = 0;
+  while(got < len)
+  {
+    ssize_t n = read(fd, (char *)buf + got, len - got);
+    if(n == -1 && errno == EINTR) continue;
+    if(n <= 0) return false;
+    got += n;
+  }
+  return true;
+}
+
+bool read_reply(int fd, cmd_response * resp, unsigned long * cells)
+{
+  static __thread cmd_cell * body;
+  static __thread size_t bodycap;
+
+  if(!read_full(fd, resp, sizeof(*resp))) return false;
+  if(resp->num_cells > bodycap)
+  {
+    body = realloc(body, sizeof(cmd_cell) * resp->num_cells);
+    bodycap = resp->num_cells;
+  }
+  *cells += resp->num_cells;
+  return read_full(fd, body, sizeof(cmd_cell) * resp->num_cells);
+}
+
+
+void * bench_main(void * arg)
+{
+  bench_thread * t = arg;
+  cmd_request reqs[MAX_DEPTH];
+
+  while(running)
+  {
+    for(int i = 0; i < t->num_fds; i++)
+    {
+      for(int d = 0; d < depth; d++)
+      {
+        cmd_request * req = &reqs[d];
+        memset(req, 0, sizeof(*req));
+        req->op = rand_r(&t->seed) % 4 ? CMD_OP_REVEAL : CMD_OP_FLAG;
+        req->row = rand_r(&t->seed) % BENCH_ROWS;
+        req->col = rand_r(&t->seed) % BENCH_COLS;
+      }
+      if(write(t->fds[i], reqs, sizeof(cmd_request) * depth) != (ssize_t)(sizeof(cmd_request) * depth))
+        return NULL;
+    }
+
+    for(int i = 0; i < t->num_fds; i++)
+    {
+      bool finished = false;
+      for(int d = 0; d < depth; d++)
+      {
+        cmd_response resp;
+        if(!read_reply(t->fds[i], &resp, &t->cells)) return NULL;
+        if(resp.game_state != CMD_GAME_PLAYING) finished = true;
+      }
+      t->moves += depth;
+
+      if(finished)
+      {
+        cmd_response resp;
+        unsigned long cells = 0;
+        t->games++;
+        if(send_request(t->fds[i], CMD_OP_NEW_GAME, BENCH_ROWS, BENCH_COLS, BENCH_MINES, rand_r(&t->seed) + 1) == -1 ||
+           !read_reply(t->fds[i], &resp, &cells))
+          return NULL;
+      }
+    }
+  }
+  return NULL;
+}
+
+double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
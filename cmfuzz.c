@@ -0,0 +1,652 @@
+// This file is licensed under GPLv3 <https://www.gnu.org/licenses/>
+// gcc cmfuzz.c -o cmfuzz -O1 -g -fsanitize=address,undefined -lcurses
+// clang cmfuzz.c -o cmfuzz -DCM_LIBFUZZER -fsanitize=fuzzer,address -lcurses
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <ncurses.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <setjmp.h>
+
+/**
+ * Differential fuzzer for the game engine in cmtest.c.
+ *
+ * The reference engine below is the plain loops from
+ * cminesweeper.proto.c: place mines one random (row, col) at a time, then
+ * walk every box and bump the counts around each mine with bounds checks
+ * (or modular wrap on a torus) on every neighbor. It is meant to stay
+ * slow and obvious. Reveals flood out with a plain queue over (row, col)
+ * and chords check their neighbors the same way.
+ *
+ * Every input describes a board geometry, a seed and a sequence of
+ * moves. Both engines build the board from the same seed and play the
+ * same moves, and the full board plus every counter in gboard is
+ * compared after generation and after each move. Any difference prints
+ * the step and aborts, which is also what libFuzzer wants to see. Half
+ * the inputs force the parallel flood fill with a tiny threshold so it
+ * gets the same checking as the serial one. The hint search runs to the
+ * end after every move and has to agree with a scan of the reference.
+ *
+ * Square boards also go through cminesweeperd.c's one byte per box
+ * engine. It deals its own mines from its own seed, so it gets a second
+ * reference board built from the mines it dealt, then plays the same
+ * moves; its cells, counters, result and the cells it reports back are
+ * checked against that.
+ *
+ * cmtest.c is compiled into this file with main renamed. exit() is
+ * turned into a longjmp back here, so anything that would end the
+ * game instead of the process. cminesweeperd.c comes in the same way.
+ *
+ *   ./cmfuzz [iterations]     random inputs, 100000 by default
+ *   ./cmfuzz <file>...        replay inputs saved by libFuzzer
+ */
+
+#define FUZZ_MAX_DIM    64
+
+static jmp_buf fuzz_exit_jump;
+static bool fuzz_exit_armed;
+
+static __attribute__((noreturn)) void fuzz_exit(int code)
+{
+  if(!fuzz_exit_armed) _exit(code);
+  longjmp(fuzz_exit_jump, 1);
+}
+
+#define main cmtest_main
+#define exit(code) fuzz_exit(code)
+#define printf(...) ((void)0)
+#include "cmtest.c"
+#undef main
+
+// the daemon has its own copies of these two
+#define main cminesweeperd_main
+#define neighbor_map cmd_neighbor_map
+#define next_random cmd_next_random
+#include "cminesweeperd.c"
+#undef next_random
+#undef neighbor_map
+#undef printf
+#undef exit
+#undef main
+
+typedef struct ref_box
+{
+  int box_type;
+  unsigned int num_mines_around;
+  bool is_revealed;
+  bool is_flagged;
+} ref_box;
+
+typedef struct ref_board
+{
+  ref_box * board;
+  uint64_t rows;
+  uint64_t columns;
+  uint64_t number_mines;
+  uint64_t num_places_revealed;
+  uint64_t flags_placed;
+  uint64_t num_mines_flagged;
+  uint64_t bbbv;
+  int topology;
+  bool lost;
+} ref_board;
+
+typedef struct fuzz_input
+{
+  const uint8_t * data;
+  size_t size;
+  size_t off;
+} fuzz_input;
+
+#define REF_LOC(b, r, c) ((b)->board[(r) * (b)->columns + (c)])
+
+#define FUZZ_MOVE_REVEAL  0
+#define FUZZ_MOVE_FLAG    1
+#define FUZZ_MOVE_CHORD   2
+#define FUZZ_MOVE_RESTART 3
+#define FUZZ_NUM_MOVES    4
+
+static const char * move_names[FUZZ_NUM_MOVES] = { "reveal", "flag", "chord", "restart" };
+
+// (row, col) steps to the six neighbors in the engine's axial hex layout
+static const int hex_map[6][2] = {
+  {-1,  0}, {-1,  1}, { 0, -1}, { 0,  1}, { 1, -1}, { 1,  0}
+};
+
+
+static uint64_t fuzz_read(fuzz_input * in, int bytes)
+{
+  uint64_t value = 0;
+  for(int i = 0; i < bytes && in->off < in->size; i++)
+    value |= (uint64_t)in->data[in->off++] << (i * 8);
+  return value;
+}
+
+
+/**
+ * Fills out[] with the (row, col) of every neighbor of (r, c) that exists
+ * and returns how many there are. A neighbor appears once per direction
+ * it can be reached from, which only matters on tiny tori.
+ */
+static int ref_neighbors(const ref_board * ref, int r, int c, int out[8][2])
+{
+  int count = 0;
+  int num = ref->topology == TOPOLOGY_HEX ? 6 : 8;
+  int rows = ref->rows, cols = ref->columns;
+
+  for(int i = 0; i < num; i++)
+  {
+    int nrow = r + (ref->topology == TOPOLOGY_HEX ? hex_map[i][0] : neighbor_map[i][1]);
+    int ncol = c + (ref->topology == TOPOLOGY_HEX ? hex_map[i][1] : neighbor_map[i][0]);
+
+    if(ref->topology == TOPOLOGY_TORUS)
+    {
+      nrow = (nrow + rows) % rows;
+      ncol = (ncol + cols) % cols;
+    }
+    else if(nrow < 0 || nrow > rows - 1 || ncol < 0 || ncol > cols - 1)
+      continue;
+
+    out[count][0] = nrow;
+    out[count][1] = ncol;
+    count++;
+  }
+  return count;
+}
+
+// 3BV by the book: a click per opening, then one per number left over
+static uint64_t ref_rate_board(const ref_board * ref)
+{
+  uint64_t size = ref->rows * ref->columns, bbbv = 0;
+  bool * seen = calloc(size, sizeof(bool));
+  int (*queue)[2] = malloc(sizeof(*queue) * size);
+
+  for(int r = 0; r < (int)ref->rows; r++)
+  {
+    for(int c = 0; c < (int)ref->columns; c++)
+    {
+      const ref_box * loc = &REF_LOC(ref, r, c);
+      if(loc->box_type == BOX_TYPE_MINE || loc->num_mines_around || seen[r * ref->columns + c]) continue;
+
+      bbbv++;
+      uint64_t head = 0, tail = 0;
+      seen[r * ref->columns + c] = true;
+      queue[tail][0] = r;
+      queue[tail++][1] = c;
+      while(head < tail)
+      {
+        int qr = queue[head][0], qc = queue[head++][1];
+        if(REF_LOC(ref, qr, qc).num_mines_around) continue;
+
+        int around[8][2];
+        int num = ref_neighbors(ref, qr, qc, around);
+        for(int i = 0; i < num; i++)
+        {
+          if(seen[around[i][0] * ref->columns + around[i][1]]) continue;
+          seen[around[i][0] * ref->columns + around[i][1]] = true;
+          queue[tail][0] = around[i][0];
+          queue[tail++][1] = around[i][1];
+        }
+      }
+    }
+  }
+
+  for(uint64_t i = 0; i < size; i++)
+    if(!seen[i] && ref->board[i].box_type != BOX_TYPE_MINE) bbbv++;
+  free(seen);
+  free(queue);
+  return bbbv;
+}
+
+// counts and rates a board whose mines are in place
+static void ref_count_mines(ref_board * ref)
+{
+  for(int r = 0; r < (int)ref->rows; r++)
+  {
+    for(int c = 0; c < (int)ref->columns; c++)
+    {
+      if(REF_LOC(ref, r, c).box_type != BOX_TYPE_MINE) continue;
+
+      int around[8][2];
+      int num = ref_neighbors(ref, r, c, around);
+      for(int i = 0; i < num; i++)
+        REF_LOC(ref, around[i][0], around[i][1]).num_mines_around++;
+    }
+  }
+
+  ref->bbbv = ref_rate_board(ref);
+}
+
+static void ref_generate_board(ref_board * ref, uint64_t seed)
+{
+  ref->board = calloc(ref->rows * ref->columns, sizeof(ref_box));
+
+  random_state = seed;
+  for(uint64_t i = 0; i < ref->number_mines; ){
+    uint64_t x = get_random_number(ref->rows);
+    uint64_t y = get_random_number(ref->columns);
+
+    ref_box * loc = &REF_LOC(ref, x, y);
+    if(loc->box_type != BOX_TYPE_MINE)
+    {
+      loc->box_type = BOX_TYPE_MINE;
+      i++;
+    }
+  }
+  ref_count_mines(ref);
+}
+
+// a fresh square reference board with the mines the daemon dealt into g
+static void ref_load_packed(ref_board * ref, const game * g)
+{
+  free(ref->board);
+  *ref = (ref_board){ .rows = g->rows, .columns = g->columns, .topology = TOPOLOGY_SQUARE };
+  ref->board = calloc(g->size, sizeof(ref_box));
+  for(uint32_t idx = 0; idx < g->size; idx++)
+  {
+    if(!(g->cells[idx] & CELL_MINE)) continue;
+    ref->board[idx].box_type = BOX_TYPE_MINE;
+    ref->number_mines++;
+  }
+  ref_count_mines(ref);
+}
+
+static void ref_set_flag(ref_board * ref, uint64_t x, uint64_t y)
+{
+  ref_box * loc = &REF_LOC(ref, x, y);
+  if(loc->is_revealed) return;
+  loc->is_flagged = !loc->is_flagged;
+  if(loc->is_flagged) ref->flags_placed++;
+  else ref->flags_placed--;
+  if(loc->box_type == BOX_TYPE_MINE)
+  {
+    if(loc->is_flagged) ref->num_mines_flagged++;
+    else ref->num_mines_flagged--;
+  }
+}
+
+static void ref_reveal_location(ref_board * ref, uint64_t x, uint64_t y)
+{
+  ref_box * loc = &REF_LOC(ref, x, y);
+  if(loc->is_flagged || loc->is_revealed) return;
+  if(loc->box_type == BOX_TYPE_MINE)
+  {
+    ref->lost = true;
+    return;
+  }
+
+  // breadth first, the engine goes depth first: the result has to match anyway
+  uint64_t size = ref->rows * ref->columns;
+  int (*queue)[2] = malloc(sizeof(int[2]) * size);
+  uint64_t head = 0, tail = 0;
+
+  loc->is_revealed = true;
+  queue[tail][0] = x;
+  queue[tail][1] = y;
+  tail++;
+
+  while(head < tail)
+  {
+    int r = queue[head][0], c = queue[head][1];
+    head++;
+    ref->num_places_revealed++;
+    if(REF_LOC(ref, r, c).num_mines_around != 0) continue;
+
+    int around[8][2];
+    int num = ref_neighbors(ref, r, c, around);
+    for(int i = 0; i < num; i++)
+    {
+      ref_box * nloc = &REF_LOC(ref, around[i][0], around[i][1]);
+      if(nloc->is_revealed || nloc->is_flagged || nloc->box_type == BOX_TYPE_MINE) continue;
+      nloc->is_revealed = true;
+      queue[tail][0] = around[i][0];
+      queue[tail][1] = around[i][1];
+      tail++;
+    }
+  }
+  free(queue);
+}
+
+static void ref_chord_location(ref_board * ref, uint64_t x, uint64_t y)
+{
+  ref_box * loc = &REF_LOC(ref, x, y);
+  if(!loc->is_revealed) return;
+
+  int around[8][2];
+  int num = ref_neighbors(ref, x, y, around);
+  unsigned int flags = 0;
+  for(int i = 0; i < num; i++)
+    if(REF_LOC(ref, around[i][0], around[i][1]).is_flagged) flags++;
+  if(flags != loc->num_mines_around) return;
+
+  for(int i = 0; i < num && !ref->lost; i++)
+    ref_reveal_location(ref, around[i][0], around[i][1]);
+}
+
+static bool ref_checkwin(const ref_board * ref)
+{
+  if(ref->num_mines_flagged == ref->number_mines) return true;
+  return ref->num_places_revealed == ref->rows * ref->columns - ref->number_mines;
+}
+
+
+static void fuzz_fail(const ref_board * ref, uint64_t seed, int step, const char * what)
+{
+  fprintf(stderr, "cmfuzz: mismatch in %s after step %d\n", what, step);
+  fprintf(stderr, "  board %" PRIu64 "x%" PRIu64 ", topology %d, %" PRIu64 " mines, seed %" PRIu64 "\n",
+          ref->rows, ref->columns, ref->topology, ref->number_mines, seed);
+  abort();
+}
+
+static void fuzz_compare(const ref_board * ref, uint64_t seed, int step)
+{
+  if(gboard.rows != ref->rows || gboard.columns != ref->columns || gboard.size != ref->rows * ref->columns)
+    fuzz_fail(ref, seed, step, "geometry");
+  if(gboard.number_mines != ref->number_mines) fuzz_fail(ref, seed, step, "number_mines");
+  if(gboard.num_places_revealed != ref->num_places_revealed) fuzz_fail(ref, seed, step, "num_places_revealed");
+  if(gboard.flags_placed != ref->flags_placed) fuzz_fail(ref, seed, step, "flags_placed");
+  if(gboard.num_mines_flagged != ref->num_mines_flagged) fuzz_fail(ref, seed, step, "num_mines_flagged");
+  if(gboard.bbbv != ref->bbbv) fuzz_fail(ref, seed, step, "3BV");
+  if(checkwin() != ref_checkwin(ref)) fuzz_fail(ref, seed, step, "checkwin");
+
+  for(uint64_t r = 0; r < ref->rows; r++)
+  {
+    for(uint64_t c = 0; c < ref->columns; c++)
+    {
+      const gbox * loc = &GET_LOC(r, c);
+      const ref_box * rloc = &REF_LOC(ref, r, c);
+      if(loc->box_type != rloc->box_type ||
+         loc->num_mines_around != rloc->num_mines_around ||
+         loc->is_revealed != rloc->is_revealed ||
+         loc->is_flagged != rloc->is_flagged)
+      {
+        fprintf(stderr, "cmfuzz: box %" PRIu64 ",%" PRIu64 " differs\n", r, c);
+        fuzz_fail(ref, seed, step, "board");
+      }
+    }
+  }
+
+  // the whole board and one rectangle that moves around with the step
+  region_tile all, part;
+  region_count(0, 0, ref->rows, ref->columns, &all);
+  if(all.revealed != ref->num_places_revealed || all.flagged != ref->flags_placed)
+    fuzz_fail(ref, seed, step, "region totals");
+
+  uint64_t r0 = step * 7 % ref->rows, c0 = step * 13 % ref->columns;
+  uint64_t r1 = r0 + step % 29 + 1, c1 = c0 + step % 31 + 1;
+  uint64_t revealed = 0, flagged = 0;
+  for(uint64_t r = r0; r < r1 && r < ref->rows; r++)
+  {
+    for(uint64_t c = c0; c < c1 && c < ref->columns; c++)
+    {
+      revealed += REF_LOC(ref, r, c).is_revealed;
+      flagged += REF_LOC(ref, r, c).is_flagged;
+    }
+  }
+  region_count(r0, c0, r1, c1, &part);
+  if(part.revealed != revealed || part.flagged != flagged)
+    fuzz_fail(ref, seed, step, "region count");
+}
+
+/**
+ * Runs the hint search the way the game does between keys and checks it
+ * against a scan of the whole reference board: it finds a hint exactly
+ * when there is one, and the box it points at is still hidden. It is
+ * only safe if the flags that made it a hint are right.
+ */
+static void fuzz_compare_hint(const ref_board * ref, uint64_t seed, int step)
+{
+  hint_reset();
+  while(hint_state == HINT_SEARCHING) hint_work();
+
+  bool any = false;
+  for(uint64_t r = 0; r < ref->rows && !any; r++)
+  {
+    for(uint64_t c = 0; c < ref->columns && !any; c++)
+    {
+      const ref_box * rloc = &REF_LOC(ref, r, c);
+      if(!rloc->is_revealed || !rloc->num_mines_around) continue;
+
+      int around[8][2];
+      int num = ref_neighbors(ref, r, c, around);
+      unsigned int flags = 0, hidden = 0;
+      for(int i = 0; i < num; i++)
+      {
+        const ref_box * nloc = &REF_LOC(ref, around[i][0], around[i][1]);
+        if(nloc->is_flagged) flags++;
+        else if(!nloc->is_revealed) hidden++;
+      }
+      any = flags == rloc->num_mines_around && hidden;
+    }
+  }
+  if((hint_state == HINT_FOUND) != any) fuzz_fail(ref, seed, step, "hint found");
+  if(hint_state != HINT_FOUND) return;
+
+  const ref_box * hint = &REF_LOC(ref, hint_box / gboard.stride - 1, hint_box % gboard.stride - 1);
+  if(hint->is_revealed || hint->is_flagged)
+    fuzz_fail(ref, seed, step, "hint box");
+}
+
+/**
+ * The daemon's game against its reference. Cells reported by the last
+ * move (what is in w->out) have to say what the board now says, except
+ * that a losing move may stop its chord part way through.
+ */
+static void fuzz_compare_packed(const ref_board * ref, const game * g, const worker * w, uint64_t seed, int step)
+{
+  if((g->state == CMD_GAME_LOST) != ref->lost) fuzz_fail(ref, seed, step, "packed game over");
+  if(ref->lost) return;
+  if(g->num_places_revealed != ref->num_places_revealed) fuzz_fail(ref, seed, step, "packed num_places_revealed");
+
+  bool won = ref->num_places_revealed == ref->rows * ref->columns - ref->number_mines;
+  if((g->state == CMD_GAME_WON) != won) fuzz_fail(ref, seed, step, "packed win");
+
+  for(uint32_t idx = 0; idx < g->size; idx++)
+  {
+    uint8_t cell = g->cells[idx];
+    const ref_box * rloc = &ref->board[idx];
+    if(!!(cell & CELL_MINE) != (rloc->box_type == BOX_TYPE_MINE) ||
+       (cell & CELL_COUNT_MASK) != rloc->num_mines_around ||
+       !!(cell & CELL_REVEALED) != rloc->is_revealed ||
+       !!(cell & CELL_FLAGGED) != rloc->is_flagged)
+    {
+      fprintf(stderr, "cmfuzz: packed box %u,%u differs\n", idx / g->columns, idx % g->columns);
+      fuzz_fail(ref, seed, step, "packed board");
+    }
+  }
+
+  for(size_t off = 0; off < w->outlen; off += sizeof(cmd_cell))
+  {
+    cmd_cell out;
+    memcpy(&out, w->out + off, sizeof(out));
+    if(out.row >= g->rows || out.col >= g->columns ||
+       out.value != cell_value(g->cells[out.row * g->columns + out.col]))
+      fuzz_fail(ref, seed, step, "packed reply");
+  }
+}
+
+/**
+ * Input layout, every field little endian and zero once the input runs out:
+ *   u8 rows-1, u8 cols-1, u32 mines, u64 seed, u8 topology, then
+ *   (u8 op, u8 row, u8 col) per move. Everything is reduced into range,
+ *   so any bytes are valid.
+ */
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size)
+{
+  fuzz_input in = { .data = data, .size = size };
+  ref_board ref = { 0 };
+
+  ref.rows = fuzz_read(&in, 1) % FUZZ_MAX_DIM + 1;
+  ref.columns = fuzz_read(&in, 1) % FUZZ_MAX_DIM + 1;
+  ref.number_mines = fuzz_read(&in, 4) % (ref.rows * ref.columns);
+  uint64_t seed = fuzz_read(&in, 8) | 1;
+  ref.topology = fuzz_read(&in, 1) % 3;
+
+  ref_generate_board(&ref, seed);
+
+  // half the inputs hand any opening past a few boxes to four threads
+  flood_threads = seed & 2 ? 4 : 1;
+  flood_parallel_min = 8;
+
+  memset(&gboard, 0, sizeof(gboard));
+  random_state = seed;
+  if(init_board(ref.columns, ref.rows, ref.topology) == -1 ||
+     generate_board(ref.number_mines, ref.columns, ref.rows) == -1)
+    fuzz_fail(&ref, seed, 0, "generate_board");
+  get_surrounding_mines();
+  gboard.bbbv = rate_board(gboard.board, &flood_stack, &flood_stack_cap);
+  hint_clear();
+  fuzz_compare(&ref, seed, 0);
+
+  // a quarter of the inputs take their restarts from the producer thread
+  if((seed & 12) == 12) pregen_start();
+
+  // the daemon only has square boards, and deals from a 32 bit seed
+  game packed = { 0 };
+  worker packed_worker = { 0 };
+  ref_board packed_ref = { 0 };
+  uint32_t packed_seed = (uint32_t)(seed ^ seed >> 32) | 1;
+  if(ref.topology == TOPOLOGY_SQUARE)
+  {
+    if(game_new(&packed, ref.rows, ref.columns, ref.number_mines, packed_seed) == -1)
+      fuzz_fail(&ref, seed, 0, "packed game_new");
+    ref_load_packed(&packed_ref, &packed);
+    if(packed_ref.number_mines != ref.number_mines) fuzz_fail(&ref, seed, 0, "packed mines dealt");
+    fuzz_compare_packed(&packed_ref, &packed, &packed_worker, seed, 0);
+  }
+
+  game_result = GAME_PLAYING;
+  for(int step = 1; in.off < in.size && !ref.lost; step++)
+  {
+    int op = fuzz_read(&in, 1) % FUZZ_NUM_MOVES;
+    uint64_t row = fuzz_read(&in, 1) % ref.rows;
+    uint64_t col = fuzz_read(&in, 1) % ref.columns;
+
+    if(op == FUZZ_MOVE_REVEAL) ref_reveal_location(&ref, row, col);
+    else if(op == FUZZ_MOVE_CHORD) ref_chord_location(&ref, row, col);
+    else if(op == FUZZ_MOVE_FLAG) ref_set_flag(&ref, row, col);
+
+    // nothing is supposed to exit() any more, but if it does it lands here
+    fuzz_exit_armed = true;
+    if(setjmp(fuzz_exit_jump) == 0)
+    {
+      if(op == FUZZ_MOVE_REVEAL) reveal_location(row, col);
+      else if(op == FUZZ_MOVE_CHORD) chord_location(row, col);
+      else if(op == FUZZ_MOVE_FLAG) set_flag(row, col);
+      else
+      {
+        // whichever way new_game() got its board, the seed it reports
+        // has to deal the same one from scratch on the reference side
+        new_game();
+        free(ref.board);
+        ref.num_places_revealed = ref.flags_placed = ref.num_mines_flagged = 0;
+        uint64_t state = random_state;
+        ref_generate_board(&ref, gboard.seed);
+        random_state = state;
+      }
+      fuzz_exit_armed = false;
+
+      if((game_result == GAME_LOST) != ref.lost) fuzz_fail(&ref, seed, step, "game over");
+      if(ref.lost && gboard.board[fatal_box].box_type != BOX_TYPE_MINE) fuzz_fail(&ref, seed, step, "fatal box");
+      // a losing chord stops part way, in each engine's own neighbor order
+      if(!ref.lost) fuzz_compare(&ref, seed, step);
+      if(!ref.lost) fuzz_compare_hint(&ref, seed, step);
+    }
+    else
+    {
+      fuzz_exit_armed = false;
+      fprintf(stderr, "cmfuzz: engine quit on %s %" PRIu64 ",%" PRIu64 "\n", move_names[op], row, col);
+      fuzz_fail(&ref, seed, step, "exit");
+    }
+
+    if(!packed.cells) continue;
+    // a finished game ignores moves, handle_request() doesn't pass them on
+    packed_worker.outlen = 0;
+    if(op == FUZZ_MOVE_RESTART)
+    {
+      if(game_new(&packed, ref.rows, ref.columns, ref.number_mines, packed_seed + step * 2) == -1)
+        fuzz_fail(&ref, seed, step, "packed game_new");
+      ref_load_packed(&packed_ref, &packed);
+    }
+    else if(packed.state == CMD_GAME_PLAYING)
+    {
+      int ret = 0;
+      if(op == FUZZ_MOVE_REVEAL)
+      {
+        ref_reveal_location(&packed_ref, row, col);
+        ret = game_reveal(&packed_worker, &packed, row, col);
+      }
+      else if(op == FUZZ_MOVE_CHORD)
+      {
+        ref_chord_location(&packed_ref, row, col);
+        ret = game_chord(&packed_worker, &packed, row, col);
+      }
+      else
+      {
+        ref_set_flag(&packed_ref, row, col);
+        game_flag(&packed_worker, &packed, row, col);
+      }
+      if(ret == -1 || packed_worker.out_failed) fuzz_fail(&packed_ref, seed, step, "packed out of memory");
+    }
+    fuzz_compare_packed(&packed_ref, &packed, &packed_worker, seed, step);
+  }
+
+  pregen_stop();
+  free_board();
+  free(ref.board);
+  game_free(&packed);
+  free(packed_worker.out);
+  free(packed_worker.stack);
+  free(packed_ref.board);
+  return 0;
+}
+
+#ifndef CM_LIBFUZZER
+int main(int argc, char ** argv)
+{
+  if(argc > 1 && access(argv[1], R_OK) == 0)
+  {
+    for(int i = 1; i < argc; i++)
+    {
+      FILE * f = fopen(argv[i], "rb");
+      if(!f) continue;
+      uint8_t buf[1 << 16];
+      size_t len = fread(buf, 1, sizeof(buf), f);
+      fclose(f);
+      LLVMFuzzerTestOneInput(buf, len);
+    }
+    fprintf(stderr, "cmfuzz: %d inputs ok\n", argc - 1);
+    return 0;
+  }
+
+  long iterations = argc > 1 ? atol(argv[1]) : 100000;
+  uint64_t state = (uint64_t)time(NULL) | 1;
+  uint8_t buf[15 + 3 * 512];
+
+  for(long i = 0; i < iterations; i++)
+  {
+    // small boards most of the time so the move list actually covers them
+    size_t len = 15 + 3 * (state % 512);
+    for(size_t j = 0; j < len; j++)
+    {
+      state ^= state >> 12;
+      state ^= state << 25;
+      state ^= state >> 27;
+      buf[j] = (state * 0x2545F4914F6CDD1DULL) >> 56;
+    }
+    if(i % 2) buf[0] %= 12, buf[1] %= 12;
+    // keep the mine count low so games last long enough to be interesting
+    if(i % 4 == 0) buf[3] = buf[4] = buf[5] = 0;
+    LLVMFuzzerTestOneInput(buf, len);
+  }
+  fprintf(stderr, "cmfuzz: %ld iterations ok\n", iterations);
+  return 0;
+}
+#endif
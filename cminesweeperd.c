@@ -0,0 +1,654 @@
+// This file is licensed under GPLv3 <https://www.gnu.org/licenses/>
+// gcc cminesweeperd.c -o cminesweeperd -O2 -lpthread
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/resource.h>
+
+#include "cminesweeperd.h"
+
+/**
+ * One process, many games.
+ *
+ * Every worker thread owns an epoll instance and its own set of
+ * connections. The listening socket is registered in all of them with
+ * EPOLLEXCLUSIVE so a new connection wakes exactly one worker, and that
+ * worker keeps the connection for its whole life. Nothing is shared
+ * between workers after startup, so there are no locks on the move path.
+ *
+ * A game is stored as one byte per box (see CELL_*) so that a connection
+ * sitting on a hard board costs well under a kilobyte.
+ */
+
+#define CELL_COUNT_MASK   0x0f
+#define CELL_MINE         0x10
+#define CELL_REVEALED     0x20
+#define CELL_FLAGGED      0x40
+
+#define MAX_EVENTS        256
+// one read() takes in up to this many bytes of pipelined requests
+#define INBUF_SIZE        (sizeof(cmd_request) * 256)
+
+typedef struct game
+{
+  uint8_t * cells;
+  uint16_t rows;
+  uint16_t columns;
+  uint32_t size;
+  uint32_t number_mines;
+  uint32_t num_places_revealed;
+  uint8_t state;
+} game;
+
+typedef struct connection
+{
+  int fd;
+  game g;
+  // the start of a request whose end hasn't arrived yet
+  unsigned int inlen;
+  uint8_t inbuf[sizeof(cmd_request)];
+  // bytes we could not write yet, only allocated under backpressure
+  uint8_t * pending;
+  size_t pending_len;
+  size_t pending_off;
+} connection;
+
+typedef struct worker
+{
+  pthread_t thread;
+  int epfd;
+  // held open so there is a descriptor to give up when accept() hits EMFILE
+  int spare_fd;
+  // requests are read here, only a partial one is kept on the connection
+  uint8_t in[INBUF_SIZE];
+  // replies for one batch of requests are built here and sent with one write
+  uint8_t * out;
+  size_t outlen;
+  size_t outcap;
+  // set when the out buffer couldn't grow; the batch is dropped and the
+  // connection closed, since a reply with missing cells would be a lie
+  bool out_failed;
+  // flood fill stack, grown to the largest board this worker has seen
+  uint32_t * stack;
+  size_t stackcap;
+} worker;
+
+// GLOBALS
+int listen_fd = -1;
+int random_fd = -1;
+
+// https://github.com/GNOME/gnome-mines/blob/master/src/minefield.vala#L49
+const int neighbor_map[8][2] = {
+    {-1, -1},
+    {-1,  0},
+    {-1,  1},
+    { 0, -1},
+    { 0,  1},
+    { 1, -1},
+    { 1,  0},
+    { 1,  1}
+};
+
+static int setup_listener(const char * path);
+static void raise_fd_limit();
+static void * worker_main(void * arg);
+static void accept_connections(worker * w);
+static void close_connection(worker * w, connection * conn);
+static void handle_readable(worker * w, connection * conn);
+static void handle_writable(worker * w, connection * conn);
+static bool flush_output(worker * w, connection * conn);
+static void handle_request(worker * w, connection * conn, const cmd_request * req);
+
+static int game_new(game * g, unsigned int rows, unsigned int cols, unsigned int mines, uint32_t seed);
+static void game_free(game * g);
+static int game_reveal(worker * w, game * g, unsigned int row, unsigned int col);
+static void game_flag(worker * w, game * g, unsigned int row, unsigned int col);
+static int game_chord(worker * w, game * g, unsigned int row, unsigned int col);
+static void game_dump(worker * w, game * g);
+static void game_lose(worker * w, game * g);
+
+static bool out_reserve(worker * w, size_t len);
+static void out_cell(worker * w, const game * g, uint32_t idx);
+static uint8_t cell_value(uint8_t cell);
+static uint64_t next_random(uint64_t * state);
+
+
+int main(int argc, char ** argv)
+{
+  const char * path = CMD_DEFAULT_SOCKET;
+  long num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if(argc > 1) path = argv[1];
+  if(argc > 2) num_workers = atol(argv[2]);
+  if(num_workers < 1) num_workers = 1;
+
+  signal(SIGPIPE, SIG_IGN);
+  raise_fd_limit();
+
+  random_fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+  if(random_fd == -1)
+  {
+    printf("Failed to open random number bag: cminesweeperd.c:%d\n",__LINE__);
+    exit(1);
+  }
+
+  listen_fd = setup_listener(path);
+  if(listen_fd == -1)
+  {
+    printf("Failed to listen on %s: %s\n", path, strerror(errno));
+    exit(1);
+  }
+
+  worker * workers = calloc(num_workers, sizeof(worker));
+  if(!workers)
+  {
+    printf("Out of memory\n");
+    exit(1);
+  }
+
+  for(long i = 0; i < num_workers; i++)
+  {
+    worker * w = &workers[i];
+    w->epfd = epoll_create1(EPOLL_CLOEXEC);
+    w->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = NULL };
+    if(w->epfd == -1 || epoll_ctl(w->epfd, EPOLL_CTL_ADD, listen_fd, &ev) == -1)
+    {
+      printf("Failed to set up epoll: %s\n", strerror(errno));
+      exit(1);
+    }
+  }
+
+  printf("cminesweeperd: serving on %s with %ld workers\n", path, num_workers);
+  fflush(stdout);
+
+  // the main thread becomes worker 0
+  for(long i = 1; i < num_workers; i++)
+    pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+  worker_main(&workers[0]);
+
+  return 0;
+}
+
+int setup_listener(const char * path)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if(strlen(path) >= sizeof(addr.sun_path))
+  {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(fd == -1) return -1;
+
+  unlink(path);
+  if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, SOMAXCONN) == -1)
+  {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// every idle game is an open socket, so the default 1024 is far too low
+void raise_fd_limit()
+{
+  struct rlimit lim;
+  if(getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max)
+  {
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+  }
+}
+
+
+void * worker_main(void * arg)
+{
+  worker * w = arg;
+  struct epoll_event events[MAX_EVENTS];
+
+  for(;;)
+  {
+    int n = epoll_wait(w->epfd, events, MAX_EVENTS, -1);
+    if(n == -1)
+    {
+      if(errno == EINTR) continue;
+      printf("epoll_wait failed: %s\n", strerror(errno));
+      exit(1);
+    }
+
+    for(int i = 0; i < n; i++)
+    {
+      connection * conn = events[i].data.ptr;
+      if(!conn)
+      {
+        accept_connections(w);
+        continue;
+      }
+
+      if(events[i].events & (EPOLLERR | EPOLLHUP))
+        close_connection(w, conn);
+      else if(events[i].events & EPOLLOUT)
+        handle_writable(w, conn);
+      else if(events[i].events & EPOLLIN)
+        handle_readable(w, conn);
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Takes every connection that is waiting. The listener is level
+ * triggered, so one left in the backlog because we are out of
+ * descriptors would wake us forever; instead the spare descriptor is
+ * given up for long enough to accept it and hang up on it.
+ */
+void accept_connections(worker * w)
+{
+  for(;;)
+  {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if(fd == -1)
+    {
+      if(errno == EINTR || errno == ECONNABORTED) continue;
+      if((errno != EMFILE && errno != ENFILE) || w->spare_fd == -1) return;
+
+      close(w->spare_fd);
+      fd = accept(listen_fd, NULL, NULL);
+      if(fd != -1) close(fd);
+      w->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+      if(fd == -1) return;
+      continue;
+    }
+
+    connection * conn = calloc(1, sizeof(connection));
+    if(!conn)
+    {
+      close(fd);
+      continue;
+    }
+    conn->fd = fd;
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = conn };
+    if(epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+    {
+      close(fd);
+      free(conn);
+    }
+  }
+}
+
+void close_connection(worker * w, connection * conn)
+{
+  epoll_ctl(w->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+  close(conn->fd);
+  game_free(&conn->g);
+  if(conn->pending) free(conn->pending);
+  free(conn);
+}
+
+
+void handle_readable(worker * w, connection * conn)
+{
+  memcpy(w->in, conn->inbuf, conn->inlen);
+  ssize_t len = read(conn->fd, w->in + conn->inlen, INBUF_SIZE - conn->inlen);
+  if(len == 0 || (len == -1 && errno != EAGAIN && errno != EINTR))
+  {
+    close_connection(w, conn);
+    return;
+  }
+  if(len == -1) return;
+  conn->inlen += len;
+
+  w->outlen = 0;
+  w->out_failed = false;
+  unsigned int off = 0;
+  for(; off + sizeof(cmd_request) <= conn->inlen && !w->out_failed; off += sizeof(cmd_request))
+  {
+    cmd_request req;
+    memcpy(&req, w->in + off, sizeof(req));
+    handle_request(w, conn, &req);
+  }
+
+  if(w->out_failed || !flush_output(w, conn))
+  {
+    close_connection(w, conn);
+    return;
+  }
+  conn->inlen -= off;
+  memcpy(conn->inbuf, w->in + off, conn->inlen);
+}
+
+void handle_writable(worker * w, connection * conn)
+{
+  ssize_t len = write(conn->fd, conn->pending + conn->pending_off, conn->pending_len - conn->pending_off);
+  if(len == -1)
+  {
+    if(errno != EAGAIN && errno != EINTR) close_connection(w, conn);
+    return;
+  }
+
+  conn->pending_off += len;
+  if(conn->pending_off < conn->pending_len) return;
+
+  free(conn->pending);
+  conn->pending = NULL;
+  conn->pending_len = conn->pending_off = 0;
+
+  // drained, go back to reading requests
+  struct epoll_event ev = { .events = EPOLLIN, .data.ptr = conn };
+  epoll_ctl(w->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+/**
+ * Sends everything in the worker's out buffer. Whatever the socket
+ * won't take right now is parked on the connection and we stop reading
+ * from it until it has been drained, so a slow client can only ever
+ * cost us one batch of replies.
+ */
+bool flush_output(worker * w, connection * conn)
+{
+  size_t sent = 0;
+  while(sent < w->outlen)
+  {
+    ssize_t len = write(conn->fd, w->out + sent, w->outlen - sent);
+    if(len == -1)
+    {
+      if(errno == EINTR) continue;
+      if(errno == EAGAIN) break;
+      return false;
+    }
+    sent += len;
+  }
+  if(sent == w->outlen) return true;
+
+  conn->pending_len = w->outlen - sent;
+  conn->pending_off = 0;
+  conn->pending = malloc(conn->pending_len);
+  if(!conn->pending) return false;
+  memcpy(conn->pending, w->out + sent, conn->pending_len);
+
+  struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = conn };
+  return epoll_ctl(w->epfd, EPOLL_CTL_MOD, conn->fd, &ev) == 0;
+}
+
+
+void handle_request(worker * w, connection * conn, const cmd_request * req)
+{
+  game * g = &conn->g;
+
+  // the header goes in first and gets its cell count patched at the end;
+  // if there's no room for it the caller drops the connection
+  if(!out_reserve(w, sizeof(cmd_response))) return;
+  size_t header_off = w->outlen;
+  w->outlen += sizeof(cmd_response);
+
+  cmd_response resp = { .status = CMD_STATUS_OK };
+
+  switch(req->op)
+  {
+    case CMD_OP_NEW_GAME:
+      if(req->row == 0 || req->col == 0 || req->row > CMD_MAX_DIM || req->col > CMD_MAX_DIM ||
+         req->mines >= (uint32_t)req->row * req->col)
+      {
+        resp.status = CMD_STATUS_BAD_ARGS;
+        break;
+      }
+      if(game_new(g, req->row, req->col, req->mines, req->seed) == -1)
+        resp.status = CMD_STATUS_NO_MEMORY;
+      break;
+    case CMD_OP_REVEAL:
+    case CMD_OP_FLAG:
+    case CMD_OP_CHORD:
+    case CMD_OP_GET_DIFF:
+      if(!g->cells)
+      {
+        resp.status = CMD_STATUS_NO_GAME;
+        break;
+      }
+      if(req->op == CMD_OP_GET_DIFF)
+      {
+        game_dump(w, g);
+        break;
+      }
+      if(req->row >= g->rows || req->col >= g->columns)
+      {
+        resp.status = CMD_STATUS_BAD_ARGS;
+        break;
+      }
+      // moves on a finished game are accepted and change nothing
+      if(g->state != CMD_GAME_PLAYING) break;
+
+      int ret = 0;
+      if(req->op == CMD_OP_REVEAL) ret = game_reveal(w, g, req->row, req->col);
+      else if(req->op == CMD_OP_FLAG) game_flag(w, g, req->row, req->col);
+      else ret = game_chord(w, g, req->row, req->col);
+      if(ret == -1) resp.status = CMD_STATUS_NO_MEMORY;
+      break;
+    default:
+      resp.status = CMD_STATUS_BAD_OP;
+  }
+
+  resp.game_state = g->state;
+  resp.num_cells = (w->outlen - header_off - sizeof(cmd_response)) / sizeof(cmd_cell);
+  memcpy(w->out + header_off, &resp, sizeof(resp));
+}
+
+
+int game_new(game * g, unsigned int rows, unsigned int cols, unsigned int mines, uint32_t seed)
+{
+  uint32_t size = rows * cols;
+
+  // reuse the old board when it is big enough, a replay is the common case
+  if(!g->cells || g->size < size)
+  {
+    uint8_t * cells = realloc(g->cells, size);
+    if(!cells) return -1;
+    g->cells = cells;
+  }
+  memset(g->cells, 0, size);
+
+  g->rows = rows;
+  g->columns = cols;
+  g->size = size;
+  g->number_mines = mines;
+  g->num_places_revealed = 0;
+  g->state = CMD_GAME_PLAYING;
+
+  uint64_t rng = seed;
+  if(!rng && read(random_fd, &rng, sizeof(rng)) != sizeof(rng)) rng = (uintptr_t)g;
+  if(!rng) rng = 1;
+
+  for(unsigned int i = 0; i < mines; )
+  {
+    uint32_t idx = ((next_random(&rng) >> 32) * size) >> 32;
+    if(g->cells[idx] & CELL_MINE) continue;
+    g->cells[idx] |= CELL_MINE;
+    i++;
+
+    int r = idx / cols, c = idx % cols;
+    for(int n = 0; n < 8; n++)
+    {
+      int nrow = r + neighbor_map[n][0];
+      int ncol = c + neighbor_map[n][1];
+      if(nrow >= 0 && nrow < (int)rows && ncol >= 0 && ncol < (int)cols)
+        g->cells[nrow * cols + ncol]++;
+    }
+  }
+  return 0;
+}
+
+void game_free(game * g)
+{
+  if(g->cells) free(g->cells);
+  g->cells = NULL;
+}
+
+int game_reveal(worker * w, game * g, unsigned int row, unsigned int col)
+{
+  uint32_t idx = row * g->columns + col;
+  uint8_t cell = g->cells[idx];
+
+  if(cell & (CELL_FLAGGED | CELL_REVEALED)) return 0;
+  if(cell & CELL_MINE)
+  {
+    game_lose(w, g);
+    return 0;
+  }
+
+  if(w->stackcap < g->size)
+  {
+    uint32_t * stack = realloc(w->stack, sizeof(uint32_t) * g->size);
+    if(!stack) return -1;
+    w->stack = stack;
+    w->stackcap = g->size;
+  }
+
+  // boxes are marked revealed as they are pushed, so each is pushed once
+  size_t top = 0;
+  g->cells[idx] |= CELL_REVEALED;
+  w->stack[top++] = idx;
+
+  while(top)
+  {
+    idx = w->stack[--top];
+    g->num_places_revealed++;
+    out_cell(w, g, idx);
+
+    if(g->cells[idx] & CELL_COUNT_MASK) continue;
+
+    int r = idx / g->columns, c = idx % g->columns;
+    for(int n = 0; n < 8; n++)
+    {
+      int nrow = r + neighbor_map[n][0];
+      int ncol = c + neighbor_map[n][1];
+      if(nrow < 0 || nrow >= g->rows || ncol < 0 || ncol >= g->columns) continue;
+
+      uint32_t nidx = nrow * g->columns + ncol;
+      if(g->cells[nidx] & (CELL_FLAGGED | CELL_REVEALED | CELL_MINE)) continue;
+      g->cells[nidx] |= CELL_REVEALED;
+      w->stack[top++] = nidx;
+    }
+  }
+
+  if(g->num_places_revealed == g->size - g->number_mines) g->state = CMD_GAME_WON;
+  return 0;
+}
+
+void game_flag(worker * w, game * g, unsigned int row, unsigned int col)
+{
+  uint32_t idx = row * g->columns + col;
+  if(g->cells[idx] & CELL_REVEALED) return;
+
+  g->cells[idx] ^= CELL_FLAGGED;
+  out_cell(w, g, idx);
+}
+
+// reveal every unflagged neighbor once the player has flagged enough of them
+int game_chord(worker * w, game * g, unsigned int row, unsigned int col)
+{
+  uint8_t cell = g->cells[row * g->columns + col];
+  if(!(cell & CELL_REVEALED)) return 0;
+
+  int flags = 0;
+  for(int n = 0; n < 8; n++)
+  {
+    int nrow = row + neighbor_map[n][0];
+    int ncol = col + neighbor_map[n][1];
+    if(nrow < 0 || nrow >= g->rows || ncol < 0 || ncol >= g->columns) continue;
+    if(g->cells[nrow * g->columns + ncol] & CELL_FLAGGED) flags++;
+  }
+  if(flags != (cell & CELL_COUNT_MASK)) return 0;
+
+  for(int n = 0; n < 8 && g->state == CMD_GAME_PLAYING; n++)
+  {
+    int nrow = row + neighbor_map[n][0];
+    int ncol = col + neighbor_map[n][1];
+    if(nrow < 0 || nrow >= g->rows || ncol < 0 || ncol >= g->columns) continue;
+    if(game_reveal(w, g, nrow, ncol) == -1) return -1;
+  }
+  return 0;
+}
+
+void game_dump(worker * w, game * g)
+{
+  for(uint32_t idx = 0; idx < g->size; idx++)
+  {
+    uint8_t cell = g->cells[idx];
+    if(cell & (CELL_REVEALED | CELL_FLAGGED) || (g->state == CMD_GAME_LOST && cell & CELL_MINE))
+      out_cell(w, g, idx);
+  }
+}
+
+void game_lose(worker * w, game * g)
+{
+  g->state = CMD_GAME_LOST;
+  for(uint32_t idx = 0; idx < g->size; idx++)
+    if(g->cells[idx] & CELL_MINE) out_cell(w, g, idx);
+}
+
+
+bool out_reserve(worker * w, size_t len)
+{
+  if(w->outlen + len <= w->outcap) return true;
+
+  size_t cap = w->outcap ? w->outcap : 4096;
+  while(cap < w->outlen + len) cap *= 2;
+
+  uint8_t * out = realloc(w->out, cap);
+  if(!out)
+  {
+    w->out_failed = true;
+    return false;
+  }
+  w->out = out;
+  w->outcap = cap;
+  return true;
+}
+
+void out_cell(worker * w, const game * g, uint32_t idx)
+{
+  if(!out_reserve(w, sizeof(cmd_cell))) return;
+
+  cmd_cell cell = {
+    .row = idx / g->columns,
+    .col = idx % g->columns,
+    .value = cell_value(g->cells[idx])
+  };
+  if(g->state == CMD_GAME_LOST && g->cells[idx] & CELL_MINE) cell.value = CMD_CELL_MINE;
+
+  memcpy(w->out + w->outlen, &cell, sizeof(cell));
+  w->outlen += sizeof(cell);
+}
+
+uint8_t cell_value(uint8_t cell)
+{
+  if(cell & CELL_REVEALED) return cell & CELL_COUNT_MASK;
+  if(cell & CELL_FLAGGED) return CMD_CELL_FLAG;
+  return CMD_CELL_HIDDEN;
+}
+
+// xorshift64*, seeded per game so a seed always replays the same board
+uint64_t next_random(uint64_t * state)
+{
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 0x2545F4914F6CDD1DULL;
+}
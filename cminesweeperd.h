@@ -0,0 +1,74 @@
+// This file is licensed under GPLv3 <https://www.gnu.org/licenses/>
+#ifndef CMINESWEEPERD_H
+#define CMINESWEEPERD_H
+
+#include <stdint.h>
+
+/**
+ * Wire protocol spoken by cminesweeperd over a unix domain socket.
+ *
+ * Every request is a fixed 16 byte cmd_request. Every request gets
+ * exactly one cmd_response followed by num_cells cmd_cell records,
+ * so a client can pipeline as many requests as it likes and read the
+ * replies back in order.
+ *
+ * Moves (reveal, flag, chord) reply with only the cells that changed.
+ * GET_DIFF replies with the diff from a fully hidden board, which is
+ * everything a client needs to rebuild the current state.
+ *
+ * All fields are in host byte order; the socket never leaves the box.
+ */
+
+#define CMD_DEFAULT_SOCKET  "/tmp/cminesweeperd.sock"
+
+#define CMD_MAX_DIM         4096
+
+#define CMD_OP_NEW_GAME     1
+#define CMD_OP_REVEAL       2
+#define CMD_OP_FLAG         3
+#define CMD_OP_CHORD        4
+#define CMD_OP_GET_DIFF     5
+
+#define CMD_STATUS_OK         0
+#define CMD_STATUS_BAD_OP     1
+#define CMD_STATUS_NO_GAME    2
+#define CMD_STATUS_BAD_ARGS   3
+#define CMD_STATUS_NO_MEMORY  4
+
+#define CMD_GAME_NONE       0
+#define CMD_GAME_PLAYING    1
+#define CMD_GAME_WON        2
+#define CMD_GAME_LOST       3
+
+// cmd_cell.value: 0-8 is a revealed box and its mine count
+#define CMD_CELL_HIDDEN     9
+#define CMD_CELL_FLAG       10
+#define CMD_CELL_MINE       11
+
+typedef struct cmd_request
+{
+  uint8_t  op;
+  uint8_t  reserved;
+  uint16_t row;       // NEW_GAME: number of rows
+  uint16_t col;       // NEW_GAME: number of columns
+  uint16_t reserved2;
+  uint32_t mines;     // NEW_GAME only
+  uint32_t seed;      // NEW_GAME only, 0 picks a random seed
+} __attribute__((packed)) cmd_request;
+
+typedef struct cmd_response
+{
+  uint8_t  status;
+  uint8_t  game_state;
+  uint16_t reserved;
+  uint32_t num_cells;
+} __attribute__((packed)) cmd_response;
+
+typedef struct cmd_cell
+{
+  uint16_t row;
+  uint16_t col;
+  uint8_t  value;
+} __attribute__((packed)) cmd_cell;
+
+#endif // CMINESWEEPERD_H
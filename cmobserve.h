@@ -0,0 +1,76 @@
+// This file is licensed under GPLv3 <https://www.gnu.org/licenses/>
+#ifndef CMOBSERVE_H
+#define CMOBSERVE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/**
+ * Layout of the POSIX shared memory segment a game publishes itself in
+ * when started with `observe <name>`. Readers map it read only and never
+ * talk to the game; the game never waits on them.
+ *
+ *  [cmo_header][plane: padded_size bytes][ring: ring_capacity cmo_events]
+ *
+ * The plane has one byte per box in the game's own padded layout (the
+ * board plus a one box ring), so box (row, col) is at
+ * plane[(row + 1) * stride + col + 1] and the game can store into it by
+ * the same index it uses for its board. Values are CMO_CELL_*.
+ *
+ * The counters under `seq` are a seqlock: seq is odd while the game is
+ * updating them, so a reader copies them out and retries if seq was odd
+ * or changed in the meantime.
+ *
+ * Every box that changes is also appended to the ring. Slot
+ * (n % ring_capacity) holds event number n and has seq == n + 1 once it
+ * is complete; anything else means it isn't written yet or has already
+ * been overwritten. A reader that falls more than ring_capacity behind
+ * ring_head has missed events and should resync from the plane.
+ */
+
+#define CMO_MAGIC           0x424f4d43   // "CMOB"
+#define CMO_VERSION         1
+
+#define CMO_CELL_HIDDEN     9
+#define CMO_CELL_FLAG       10
+#define CMO_CELL_MINE       11
+#define CMO_CELL_OFFBOARD   12
+
+#define CMO_GAME_PLAYING    1
+#define CMO_GAME_WON        2
+#define CMO_GAME_LOST       3
+#define CMO_GAME_CLOSED     4   // the game quit, nothing more will change
+
+typedef struct cmo_event
+{
+  _Atomic uint64_t seq;
+  _Atomic uint64_t event;    // padded box index << 8 | CMO_CELL_* value
+} cmo_event;
+
+typedef struct cmo_header
+{
+  // fixed once the segment is created
+  uint32_t magic;
+  uint32_t version;
+  uint64_t rows;
+  uint64_t columns;
+  uint64_t stride;
+  uint64_t padded_size;
+  uint64_t topology;
+  uint64_t number_mines;
+  uint64_t ring_capacity;    // a power of two
+  uint64_t plane_offset;
+  uint64_t ring_offset;
+
+  // seqlock protected
+  _Atomic uint64_t seq;
+  _Atomic uint64_t num_places_revealed;
+  _Atomic uint64_t flags_placed;
+  _Atomic uint64_t num_mines_flagged;
+  _Atomic uint64_t game_state;
+
+  // number of events ever appended to the ring
+  _Atomic uint64_t ring_head;
+} cmo_header;
+
+#endif // CMOBSERVE_H
@@ -0,0 +1,182 @@
+// This file is licensed under GPLv3 <https://www.gnu.org/licenses/>
+// gcc cmtelem.c -o cmtelem
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "cmtelemetry.h"
+
+/**
+ * Reader for the files `cmtest <difficulty> telemetry <file>` writes.
+ *
+ *   cmtelem <file>...       one tab separated line per game
+ *   cmtelem -s <file>...    games, results and pace per preset
+ *
+ * Pass rotated files oldest first (<file>.2 <file>.1 <file>) to get the
+ * games in the order they were played.
+ */
+
+#define READ_RECORDS  4096
+
+typedef struct summary
+{
+  uint64_t games;
+  uint64_t results[4];
+  uint64_t won_ms;
+  uint64_t won_bbbv;
+} summary;
+
+// GLOBALS
+bool summarize;
+summary presets[4];
+
+static const char * preset_names[] = { "easy", "medium", "hard", "custom" };
+static const char * topology_names[] = { "square", "torus", "hex" };
+static const char * result_names[] = { "?", "won", "lost", "abandoned" };
+
+static int read_file(const char * path);
+static void swap_header(cmt_file_header * header);
+static void swap_record(cmt_record * rec);
+static void print_record(const cmt_record * rec);
+static void print_summary();
+
+
+int main(int argc, char ** argv)
+{
+  int opt;
+  while((opt = getopt(argc, argv, "s")) != -1)
+  {
+    if(opt != 's')
+    {
+      printf("usage: %s [-s] <file>...\n", argv[0]);
+      exit(1);
+    }
+    summarize = true;
+  }
+  if(optind == argc)
+  {
+    printf("usage: %s [-s] <file>...\n", argv[0]);
+    exit(1);
+  }
+
+  if(!summarize)
+    printf("started_ms\tpreset\tshape\trows\tcolumns\tmines\tseed\tresult\tms\tclicks\tflags\t3bv\tfatal\n");
+
+  int ret = 0;
+  for(int i = optind; i < argc; i++)
+    if(read_file(argv[i]) == -1) ret = 1;
+
+  if(summarize) print_summary();
+  return ret;
+}
+
+int read_file(const char * path)
+{
+  FILE * f = fopen(path, "rb");
+  if(!f)
+  {
+    fprintf(stderr, "Failed to open %s\n", path);
+    return -1;
+  }
+
+  // an empty file is a log nothing has been written to yet
+  cmt_file_header header;
+  size_t got = fread(&header, 1, sizeof(header), f);
+  if(got == 0 && feof(f))
+  {
+    fclose(f);
+    return 0;
+  }
+  // written on a machine of the other byte order
+  bool swapped = got == sizeof(header) && header.magic == __builtin_bswap32(CMT_MAGIC);
+  if(swapped) swap_header(&header);
+  if(got != sizeof(header) || header.magic != CMT_MAGIC ||
+     header.version != CMT_VERSION || header.record_size != sizeof(cmt_record))
+  {
+    fprintf(stderr, "%s is not a telemetry file this reader understands\n", path);
+    fclose(f);
+    return -1;
+  }
+
+  cmt_record * recs = malloc(sizeof(cmt_record) * READ_RECORDS);
+  size_t n;
+  while((n = fread(recs, sizeof(cmt_record), READ_RECORDS, f)) > 0)
+  {
+    for(size_t i = 0; i < n; i++)
+    {
+      if(swapped) swap_record(&recs[i]);
+      if(!summarize)
+      {
+        print_record(&recs[i]);
+        continue;
+      }
+
+      summary * sum = &presets[recs[i].preset & 3];
+      sum->games++;
+      sum->results[recs[i].result & 3]++;
+      if(recs[i].result == CMT_RESULT_WON)
+      {
+        sum->won_ms += recs[i].duration_ms;
+        sum->won_bbbv += recs[i].bbbv;
+      }
+    }
+  }
+
+  free(recs);
+  fclose(f);
+  return 0;
+}
+
+void swap_header(cmt_file_header * header)
+{
+  header->magic = __builtin_bswap32(header->magic);
+  header->version = __builtin_bswap32(header->version);
+  header->record_size = __builtin_bswap32(header->record_size);
+  header->reserved = __builtin_bswap32(header->reserved);
+}
+
+// the u8 fields at the end read the same either way
+void swap_record(cmt_record * rec)
+{
+  rec->seed = __builtin_bswap64(rec->seed);
+  rec->started_ms = __builtin_bswap64(rec->started_ms);
+  rec->rows = __builtin_bswap64(rec->rows);
+  rec->columns = __builtin_bswap64(rec->columns);
+  rec->mines = __builtin_bswap64(rec->mines);
+  rec->bbbv = __builtin_bswap64(rec->bbbv);
+  rec->fatal_row = __builtin_bswap64(rec->fatal_row);
+  rec->fatal_col = __builtin_bswap64(rec->fatal_col);
+  rec->duration_ms = __builtin_bswap32(rec->duration_ms);
+  rec->clicks = __builtin_bswap32(rec->clicks);
+  rec->flags = __builtin_bswap32(rec->flags);
+}
+
+void print_record(const cmt_record * rec)
+{
+  printf("%" PRIu64 "\t%s\t%s\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%s\t%" PRIu32 "\t%" PRIu32 "\t%" PRIu32 "\t%" PRIu64 "\t",
+         rec->started_ms, preset_names[rec->preset & 3], rec->topology < 3 ? topology_names[rec->topology] : "?",
+         rec->rows, rec->columns, rec->mines, rec->seed, result_names[rec->result & 3],
+         rec->duration_ms, rec->clicks, rec->flags, rec->bbbv);
+  if(rec->fatal_row == CMT_NO_BOX) printf("-\n");
+  else printf("%" PRIu64 ",%" PRIu64 "\n", rec->fatal_row, rec->fatal_col);
+}
+
+void print_summary()
+{
+  printf("preset\tgames\twon\tlost\tabandoned\tavg win s\t3bv/s\n");
+  for(int p = 0; p < 4; p++)
+  {
+    const summary * sum = &presets[p];
+    if(!sum->games) continue;
+
+    uint64_t won = sum->results[CMT_RESULT_WON];
+    printf("%s\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%.1f\t%.2f\n",
+           preset_names[p], sum->games, won, sum->results[CMT_RESULT_LOST], sum->results[CMT_RESULT_ABANDONED],
+           won ? sum->won_ms / 1000.0 / won : 0.0,
+           sum->won_ms ? sum->won_bbbv / (sum->won_ms / 1000.0) : 0.0);
+  }
+}
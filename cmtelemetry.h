@@ -0,0 +1,64 @@
+// This file is licensed under GPLv3 <https://www.gnu.org/licenses/>
+#ifndef CMTELEMETRY_H
+#define CMTELEMETRY_H
+
+#include <stdint.h>
+
+/**
+ * Per-game telemetry written by `cmtest <difficulty> telemetry <file>`.
+ *
+ *  [cmt_file_header][cmt_record][cmt_record]...
+ *
+ * Files are only ever appended to: the header as soon as the file is
+ * created, then a whole number of records at a time.
+ * Once one passes the game's rotation size it is renamed to <file>.1
+ * (the older ones moving up to <file>.2 and so on) and a new one is
+ * started, so every file read alone is complete. Everything is in the
+ * writer's byte order; the header's magic tells a reader which one, and
+ * cmtelem swaps a file from the other order as it reads it.
+ */
+
+#define CMT_MAGIC           0x4c544d43   // "CMTL"
+#define CMT_VERSION         1
+
+#define CMT_PRESET_EASY     0
+#define CMT_PRESET_MEDIUM   1
+#define CMT_PRESET_HARD     2
+#define CMT_PRESET_CUSTOM   3
+
+#define CMT_RESULT_WON        1
+#define CMT_RESULT_LOST       2
+#define CMT_RESULT_ABANDONED  3   // restarted or quit mid-game
+
+#define CMT_NO_BOX          UINT64_MAX
+
+typedef struct cmt_file_header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t reserved;
+} cmt_file_header;
+
+typedef struct cmt_record
+{
+  uint64_t seed;          // replays the board, see gboard.seed
+  uint64_t started_ms;    // wall clock, ms since the epoch
+  uint64_t rows;
+  uint64_t columns;
+  uint64_t mines;
+  uint64_t bbbv;          // 0 if the board wasn't rated
+  uint64_t fatal_row;     // the mine that lost the game, else CMT_NO_BOX
+  uint64_t fatal_col;
+  uint32_t duration_ms;
+  uint32_t clicks;        // reveals and chords
+  uint32_t flags;         // flags placed or taken back
+  uint8_t preset;
+  uint8_t topology;
+  uint8_t result;
+  uint8_t reserved;
+} cmt_record;
+
+_Static_assert(sizeof(cmt_record) == 80, "cmt_record is part of the file format");
+
+#endif // CMTELEMETRY_H
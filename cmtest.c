@@ -1,12 +1,37 @@
 // This file is licensed under GPLv3 <https://www.gnu.org/licenses/>
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <ncurses.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+
+#include "cmobserve.h"
+#include "cmtelemetry.h"
 
 #define BOX_TYPE_EMPTY    0
 #define BOX_TYPE_MINE     1
+#define BOX_TYPE_SENTINEL 2
+
+#define TOPOLOGY_SQUARE   0
+#define TOPOLOGY_TORUS    1
+#define TOPOLOGY_HEX      2
 
 #define EASY_NUM_MINES    10
 #define EASY_COLS         8
@@ -23,32 +48,212 @@
 #define REVEALED_COLOR    0x19
 #define FLAG_COLOR        0x90
 
+#define EXPORT_TEXT       0
+#define EXPORT_PBM        1
+#define EXPORT_PGM        2
+#define EXPORT_RLE        3
+
+#define EXPORT_BUFFER_SIZE  (1 << 20)
+
+// events kept for spectators, see cmobserve.h
+#define OBSERVE_RING_SIZE   (1 << 16)
+
+#define GAME_PLAYING      0
+#define GAME_WON          1
+#define GAME_LOST         2
+#define GAME_RESTART      3
+
+#define HINT_NONE         0
+#define HINT_SEARCHING    1
+#define HINT_FOUND        2
+
+// boxes the hint search looks at between checks for input
+#define HINT_SLICE        65536
+
+// never draw more often than this, input arriving faster is batched
+#define FRAME_INTERVAL_MS 16
+
+// the smallest region tree tiles are 2^REGION_BASE_SHIFT boxes a side
+#define REGION_BASE_SHIFT 3
+#define REGION_MAX_LEVELS 64
+
+// openings whose frontier outgrows this are finished by every core
+#define FLOOD_PARALLEL_MIN  4096
+#define FLOOD_MAX_THREADS   64
+// a busy flood worker checks for idle ones every this many boxes
+#define FLOOD_CHECK_EVERY   1024
+
+// boards dealt ahead of time: at most this many, in at most this much memory
+#define PREGEN_MAX_DEPTH    8
+#define PREGEN_MEMORY       (64 << 20)
+// past this the game thread doesn't stop to rate a board itself
+#define RATE_MAX_BOXES      (1 << 24)
+
+// telemetry records held in memory between writes, see cmtelemetry.h
+#define TELEMETRY_BATCH     4096
+#define TELEMETRY_FLUSH_MS  1000      // longest a finished game waits in memory
+#define TELEMETRY_ROTATE    (64 << 20)
+#define TELEMETRY_KEEP      8
+
+// keep this small, a billion box board is a billion of these
 typedef struct gbox
 { 
-  int box_type;
-  unsigned int num_mines_around;
+  uint8_t box_type;
+  uint8_t num_mines_around;
 	bool is_revealed;
 	bool is_flagged;
 } gbox;
 
+typedef struct region_tile
+{
+  uint64_t revealed;
+  uint64_t flagged;
+} region_tile;
+
+/**
+ * Revealed and flagged counts per square tile of the board, at every
+ * power of two tile size from 8x8 up to a single tile over the whole
+ * board. Level l tiles are (8 << l) boxes a side and each one is the sum
+ * of the (up to) four below it, so a box changing costs one add per
+ * level and anything asked about a tile is a lookup. A box is never
+ * both revealed and flagged, so the rest of a tile is still hidden.
+ */
+typedef struct region_tree
+{
+  int num_levels;
+  uint64_t rows[REGION_MAX_LEVELS];     // in tiles
+  uint64_t columns[REGION_MAX_LEVELS];
+  region_tile * tiles[REGION_MAX_LEVELS];
+} region_tree;
+
+// work handed from a busy flood worker to an idle one
+typedef struct flood_chunk
+{
+  struct flood_chunk * next;
+  uint64_t len;
+  uint64_t boxes[];
+} flood_chunk;
+
+typedef struct flood_worker
+{
+  pthread_t thread;
+  uint64_t * stack;
+  uint64_t top;
+  uint64_t cap;
+  uint64_t revealed;
+  uint64_t tile;       // leaf region tile the pending reveals belong to
+  uint64_t tile_revealed;
+  uint64_t lo;         // lowest and highest box this worker revealed
+  uint64_t hi;
+} flood_worker;
+
+// a dealt, counted and rated board waiting for its game
+typedef struct pregen_board
+{
+  gbox * board;
+  uint64_t * mines;
+  uint64_t seed;
+  uint64_t bbbv;
+} pregen_board;
+
+/**
+ * Single producer, single consumer ring of boards. Only the pushing
+ * side writes head and only the popping side writes tail, so neither
+ * needs a lock.
+ */
+typedef struct pregen_ring
+{
+  _Atomic uint64_t head;
+  _Atomic uint64_t tail;
+  pregen_board * slots[PREGEN_MAX_DEPTH];
+} pregen_ring;
+
+/**
+ * The board is (rows + 2) x (columns + 2): a ring of BOX_TYPE_SENTINEL
+ * boxes around the real ones, so every neighbor of a real box is
+ * board[idx + neighbors[k]] with no bounds checks. Indices below are
+ * into that padded array; GET_LOC takes real (row, col).
+ *
+ * Square and hex sentinels are permanently revealed, which every pass
+ * already skips. On a torus they are left hidden and stand in for the
+ * box on the far edge, see torus_wrap().
+ */
 typedef struct gameboard
 {
   gbox * board;
-  gbox ** mines;
-  unsigned int columns;
-  unsigned int size;
-  unsigned int rows;
-  unsigned int number_mines;
-  unsigned int num_places_revealed;
-  unsigned int flags_placed;
-  unsigned int num_mines_flagged;
+  uint64_t * mines;   // board index of every mine
+  uint64_t columns;
+  uint64_t stride;    // columns + 2
+  int64_t neighbors[8];
+  int num_neighbors;
+  int topology;
+  uint64_t size;
+  uint64_t rows;
+  uint64_t number_mines;
+  uint64_t num_places_revealed;
+  uint64_t flags_placed;
+  uint64_t num_mines_flagged;
+  uint64_t seed;      // random_state the mines were dealt from
+  uint64_t bbbv;      // 3BV, 0 if the board wasn't rated
+  region_tree regions;
 } gameboard;  
 
 gameboard gboard;
 
 // GLOBALS
 FILE * random_number_bag;
+uint64_t random_state;
+uint64_t * flood_stack;
+uint64_t flood_stack_cap;
+uint64_t flood_parallel_min = FLOOD_PARALLEL_MIN;
+int flood_threads;           // 0 until first needed, then the online CPUs
+pthread_mutex_t flood_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t flood_wake = PTHREAD_COND_INITIALIZER;
+flood_chunk * flood_shared;  // under flood_lock, as are the three below
+int flood_idle;
+int flood_running;
+bool flood_done;
+atomic_int flood_hungry;
+atomic_bool flood_failed;
+pregen_board pregen_boards[PREGEN_MAX_DEPTH];
+int pregen_depth;            // 0 while there is no producer
+pregen_ring pregen_ready;    // producer to game
+pregen_ring pregen_spare;    // game to producer
+sem_t pregen_wake;           // counts boards in pregen_spare
+atomic_bool pregen_stopping;
+pthread_t pregen_thread;
+uint64_t pregen_state;       // the producer's own random_state
 WINDOW * gamewindow;
+WINDOW * clockwindow;
+int signal_fd = -1;          // SIGINT, SIGTERM and SIGHUP, see main()
+long long game_started;
+long long game_finished;
+int game_result;
+int game_preset = CMT_PRESET_MEDIUM;
+uint32_t game_clicks;
+uint32_t game_flags;
+uint64_t fatal_box = CMT_NO_BOX;
+int hint_state = HINT_NONE;
+uint64_t hint_scan;
+uint64_t hint_end;           // hint_work() stops here
+uint64_t hint_box;
+uint64_t hint_lo = UINT64_MAX; // boxes moves have changed since hint_reset()
+uint64_t hint_hi;
+bool show_minimap;
+bool minimap_drawn;          // the board view only overwrites its own boxes
+uint64_t view_row;           // the box in the board window's top left corner
+uint64_t view_col;
+cmo_header * observer;
+uint8_t * observer_plane;
+cmo_event * observer_ring;
+size_t observer_len;
+char observer_name[256];
+int telemetry_fd = -1;
+cmt_record * telemetry_buf;
+size_t telemetry_len;
+uint64_t telemetry_size;
+long long telemetry_flushed;
+char telemetry_path[4096];
 
 // https://github.com/GNOME/gnome-mines/blob/master/src/minefield.vala#L49
 const int neighbor_map[8][2] = {
@@ -65,7 +270,7 @@ const int neighbor_map[8][2] = {
 
 
 // #define GET_LOC(ROW, COL) gameboard[(ROW  + (COL))]
-#define GET_LOC(r, c) (gboard.board[((r) * (gboard.columns)) + (c)])
+#define GET_LOC(r, c) (gboard.board[((uint64_t)(r) + 1) * (gboard.stride) + (c) + 1])
 // #define GET_LOC(ROW, COL) gameboard[((ROW + COL + sizeof(gbox)) * sizeof(gbox))]
 
 /**
@@ -78,25 +283,74 @@ const int neighbor_map[8][2] = {
  */
 
 void debug_dump_board_info();
-int generate_board(unsigned int num_mines, unsigned int num_cols, unsigned int num_rows);
-void init_board(unsigned int num_cols, unsigned int num_rows);
+int export_board(int fd, int format);
+int parse_export_format(const char * name);
+int generate_board(uint64_t num_mines, uint64_t num_cols, uint64_t num_rows);
+void deal_mines(gbox * board, uint64_t * mines, uint64_t num_mines, uint64_t * state);
+uint64_t rate_board(gbox * board, uint64_t ** stack, uint64_t * cap);
+int init_board(uint64_t num_cols, uint64_t num_rows, int topology);
+void init_ring(gbox * board);
+void clear_board();
 void free_board();
-int calculate_surrounding_mines(const gbox * const loc, unsigned int row, unsigned int col);
-void get_surrounding_mines(unsigned int row, unsigned int col);
-void parse_options(int argc, char ** argv);
-unsigned int get_random_number(unsigned int max);
+void new_game();
+void calculate_surrounding_mines(gbox * board, uint64_t idx);
+void get_surrounding_mines();
+void count_mines(gbox * board, const uint64_t * mines);
+uint64_t torus_wrap(uint64_t idx);
+int region_init();
+void region_free();
+void region_add(uint64_t idx, int64_t revealed, int64_t flagged);
+void region_count(uint64_t r0, uint64_t c0, uint64_t r1, uint64_t c1, region_tile * out);
+void region_rebuild();
+void region_clear();
+int parse_options(int argc, char ** argv);
+int parse_topology(const char * name);
+int parse_custom(char ** argv, uint64_t * rows, uint64_t * cols, uint64_t * mines);
+uint64_t get_random_number(uint64_t max);
+uint64_t next_random(uint64_t * state, uint64_t max);
+void seed_random();
+int pregen_start();
+void pregen_stop();
 void init_window();
 void cleanup();
-void gameover();
+__attribute__((noreturn)) void quit_game(int code);
+void quit_on_signal();
+void gameover(uint64_t idx);
 void nc_print_board(WINDOW * win, int curx, int cury);
-void movement_handler();
-
-void set_flag(int x, int y);
-void reveal_location(int x, int y);
+void nc_print_minimap(WINDOW * win, int curx, int cury);
+bool movement_handler();
+bool handle_key(int ch, int * currow, int * curcol);
+bool drain_input(int * currow, int * curcol);
+long long now_ms();
+void draw_clock();
+void hint_clear();
+void hint_touch(uint64_t lo, uint64_t hi);
+void hint_reset();
+void hint_work();
+
+bool set_flag(uint64_t x, uint64_t y);
+void reveal_location(uint64_t x, uint64_t y);
+void chord_location(uint64_t x, uint64_t y);
+void flood_reveal(uint64_t idx);
+bool flood_parallel(uint64_t top);
+int reveal_bench(int threads);
 
 bool checkwin();
 void wingame();
 
+int observe_open(const char * name);
+void observe_close();
+void observe_reset();
+void observe_box(uint64_t idx, uint8_t value);
+void observe_counters(int state);
+void observe_gameover(int state);
+
+int telemetry_open(const char * path);
+void telemetry_game(int result);
+void telemetry_flush();
+void telemetry_close();
+int telemetry_header();
+
 
 int main(int argc, char ** argv)
 {
@@ -106,8 +360,90 @@ int main(int argc, char ** argv)
     printf("Failed to open random number bag: cminesweeper.c:%d\n",__LINE__);
     exit(1);
   }
-  parse_options(argc, argv);
-	get_surrounding_mines(gboard.rows, gboard.columns);
+  int next_arg = parse_options(argc, argv);
+	get_surrounding_mines();
+
+  // cmtest <difficulty> observe <name>: publish the game for spectators
+  if(argc > next_arg + 1 && strcmp(argv[next_arg], "observe") == 0)
+  {
+    if(observe_open(argv[next_arg + 1]) == -1)
+    {
+      if(errno == EEXIST)
+        printf("%s is already published by another game, or was left behind by one that crashed (see /dev/shm)\n", argv[next_arg + 1]);
+      else printf("Failed to create shared memory %s: %s\n", argv[next_arg + 1], strerror(errno));
+      free_board();
+      exit(1);
+    }
+    next_arg += 2;
+  }
+
+  // cmtest <difficulty> telemetry <file>: log every game played
+  if(argc > next_arg + 1 && strcmp(argv[next_arg], "telemetry") == 0)
+  {
+    if(telemetry_open(argv[next_arg + 1]) == -1)
+    {
+      printf("Failed to open %s: %s\n", argv[next_arg + 1], strerror(errno));
+      observe_close();
+      free_board();
+      exit(1);
+    }
+    next_arg += 2;
+  }
+
+  // cmtest <difficulty> export <format> [file]: dump the board and quit
+  if(argc > next_arg && strcmp(argv[next_arg], "export") == 0)
+  {
+    int format = argc > next_arg + 1 ? parse_export_format(argv[next_arg + 1]) : EXPORT_TEXT;
+    int fd = argc > next_arg + 2 ? open(argv[next_arg + 2], O_WRONLY | O_CREAT | O_TRUNC, 0644) : STDOUT_FILENO;
+    if(format == -1 || fd == -1)
+    {
+      printf("Usage: %s <difficulty> export [text|pbm|pgm|rle] [file]\n", argv[0]);
+      observe_close();
+      telemetry_close();
+      exit(1);
+    }
+    int ret = export_board(fd, format);
+    if(fd != STDOUT_FILENO) close(fd);
+    observe_close();
+    telemetry_close();
+    free_board();
+    fclose(random_number_bag);
+    return ret == -1 ? 1 : 0;
+  }
+
+  // cmtest <difficulty> reveal-bench [threads]: time one opening and quit
+  if(argc > next_arg && strcmp(argv[next_arg], "reveal-bench") == 0)
+  {
+    int threads = argc > next_arg + 1 ? atoi(argv[next_arg + 1]) : 0;
+    if(threads < 0 || threads > FLOOD_MAX_THREADS)
+    {
+      printf("Usage: %s <difficulty> reveal-bench [1-%d threads, default every core]\n", argv[0], FLOOD_MAX_THREADS);
+      observe_close();
+      telemetry_close();
+      exit(1);
+    }
+    int ret = reveal_bench(threads);
+    observe_close();
+    telemetry_close();
+    free_board();
+    fclose(random_number_bag);
+    return ret == -1 ? 1 : 0;
+  }
+
+  // quitting signals are read from poll() like a key, so they get the same
+  // cleanup as 'q' and don't leave the spectator segment behind. They are
+  // blocked before any thread starts so none of the helpers can take one.
+  sigset_t quit_signals;
+  sigemptyset(&quit_signals);
+  sigaddset(&quit_signals, SIGINT);
+  sigaddset(&quit_signals, SIGTERM);
+  sigaddset(&quit_signals, SIGHUP);
+  if(sigprocmask(SIG_BLOCK, &quit_signals, NULL) == 0)
+    signal_fd = signalfd(-1, &quit_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+  if(gboard.size <= RATE_MAX_BOXES) gboard.bbbv = rate_board(gboard.board, &flood_stack, &flood_stack_cap);
+  // no producer just means every restart deals its own board
+  pregen_start();
 
 	initscr();
   clear();
@@ -121,10 +457,10 @@ int main(int argc, char ** argv)
   init_pair(REVEALED_COLOR, COLOR_BLACK, COLOR_BLUE);
   init_pair(FLAG_COLOR, COLOR_BLACK, COLOR_RED);
 
-	movement_handler();
-	getch();
+	while(movement_handler()) new_game();
 
 	cleanup();
+	return 0;
 } 
 
 
@@ -133,9 +469,11 @@ int main(int argc, char ** argv)
 
 
 
-void parse_options(int argc, char ** argv)
+// returns the index of the first argument it didn't use
+int parse_options(int argc, char ** argv)
 {
-  int ccol = 0, crow = 0, cmines = 0;
+  uint64_t ccol = 0, crow = 0, cmines = 0;
+  int next_arg = 2;
 
   if(argc == 1 || strcmp(argv[1], "medium") == 0)
   {
@@ -145,19 +483,41 @@ void parse_options(int argc, char ** argv)
   }
   else if(strcmp(argv[1], "hard") == 0)
   {
+    game_preset = CMT_PRESET_HARD;
     ccol =   HARD_COLS;
     crow =   HARD_ROWS;
     cmines = HARD_NUM_MINES;
   } 
   else if(strcmp(argv[1], "easy") == 0)
   {
+    game_preset = CMT_PRESET_EASY;
     ccol =   EASY_COLS;
     crow =   EASY_ROWS;
     cmines = EASY_NUM_MINES;
   }
+  else if(strcmp(argv[1], "custom") == 0)
+  {
+    if(argc < 5 || parse_custom(argv + 2, &crow, &ccol, &cmines) == -1)
+    {
+      printf("Usage: %s custom <rows> <cols> <mines|density>\n", argv[0]);
+      printf("density is a fraction of the board, either 0.15 or 15%%\n");
+      exit(1);
+    }
+    game_preset = CMT_PRESET_CUSTOM;
+    next_arg = 5;
+  }
   else if(strcmp(argv[1], "help") == 0)
   {
     printf("'a' -> clear spot\n'f' -> place a flag\n'q' -> exit\n");
+    printf("custom <rows> <cols> <mines|density> -> any board size\n");
+    printf("'c' -> clear around a number once its mines are flagged\n");
+    printf("'h' -> jump to a box that is safe to clear, when one is known\n");
+    printf("<difficulty> [square|torus|hex] -> board shape, square by default\n");
+    printf("'n' -> start a new game\n'm' -> toggle the minimap\n");
+    printf("<difficulty> observe <name> -> publish the game in shared memory for cmwatch\n");
+    printf("<difficulty> telemetry <file> -> append a record of every game to file, see cmtelem\n");
+    printf("<difficulty> export [text|pbm|pgm|rle] [file] -> write the board out and exit\n");
+    printf("<difficulty> reveal-bench [threads] -> time clearing the first opening and exit\n");
     cleanup();
     exit(0);
   } else {
@@ -165,7 +525,15 @@ void parse_options(int argc, char ** argv)
     exit(1);
   }
 
-  init_board(ccol, crow);
+  int topology = TOPOLOGY_SQUARE;
+  if(argc > next_arg && parse_topology(argv[next_arg]) != -1)
+    topology = parse_topology(argv[next_arg++]);
+
+  if(init_board(ccol, crow, topology) == -1)
+  {
+    printf("Not enough memory for a %" PRIu64 "x%" PRIu64 " board\n", crow, ccol);
+    exit(1);
+  }
   
   if(generate_board(cmines, ccol, crow) == -1)
   {
@@ -174,137 +542,616 @@ void parse_options(int argc, char ** argv)
     exit(1);
   }
   
+  return next_arg;
+}
+
+int parse_topology(const char * name)
+{
+  if(strcmp(name, "square") == 0) return TOPOLOGY_SQUARE;
+  if(strcmp(name, "torus") == 0) return TOPOLOGY_TORUS;
+  if(strcmp(name, "hex") == 0) return TOPOLOGY_HEX;
+  return -1;
 }
 
+/**
+ * Reads "<rows> <cols> <mines|density>". The last one is a mine count
+ * unless it has a '.' or a '%' in it. There has to be at least one mine,
+ * since flagging every mine wins, and one box left over that isn't a mine.
+ */
+int parse_custom(char ** argv, uint64_t * rows, uint64_t * cols, uint64_t * mines)
+{
+  char * end;
+  uint64_t size;
+
+  errno = 0;
+  *rows = strtoull(argv[0], &end, 10);
+  if(errno || *end || *rows == 0 || argv[0][0] == '-') return -1;
+  *cols = strtoull(argv[1], &end, 10);
+  if(errno || *end || *cols == 0 || argv[1][0] == '-') return -1;
+  if(__builtin_mul_overflow(*rows, *cols, &size)) return -1;
+
+  if(strchr(argv[2], '.') || strchr(argv[2], '%'))
+  {
+    double density = strtod(argv[2], &end);
+    if(*end == '%')
+    {
+      density /= 100;
+      end++;
+    }
+    if(*end || !(density >= 0 && density < 1)) return -1;
+    *mines = (uint64_t)(density * (double)size);
+  }
+  else
+  {
+    *mines = strtoull(argv[2], &end, 10);
+    if(errno || *end || argv[2][0] == '-') return -1;
+  }
+
+  return *mines > 0 && *mines < size ? 0 : -1;
+}
 
-int generate_board(unsigned int num_mines, unsigned int num_cols, unsigned int num_rows)
+int generate_board(uint64_t num_mines, uint64_t num_cols, uint64_t num_rows)
 {
   if(!gboard.board) return -1;
+  if(num_mines >= num_cols * num_rows) return -1;
   gboard.number_mines = num_mines;
   
-  // we are holding pointers to the mines which is why we
-  // use sizeof(gbox *) and not sizeof(gbox)
-  gboard.mines = (gbox **)malloc(sizeof(gbox **) * num_mines);
+  // indices, not pointers: same size on 64 bit and they survive a realloc
+  if(num_mines > SIZE_MAX / sizeof(uint64_t)) return -1;
+  uint64_t * mines = (uint64_t *)realloc(gboard.mines, sizeof(uint64_t) * (num_mines ? num_mines : 1));
+  if(!mines) return -1;
+  gboard.mines = mines;
+
+  seed_random();
+  gboard.seed = random_state;
+  deal_mines(gboard.board, gboard.mines, num_mines, &random_state);
 
-  int mines_placed = 0;
   
 
-  for(int i = 0; i < num_mines; ){
-     int x = get_random_number(num_rows);
-    int y = get_random_number(num_cols);
-    // printf("%d:%d\n",x,y);
+  return 0;
+}
+
+// lays num_mines on an empty board of gboard's shape, drawing from *state
+void deal_mines(gbox * board, uint64_t * mines, uint64_t num_mines, uint64_t * state)
+{
+  for(uint64_t i = 0; i < num_mines; ){
+    uint64_t x = next_random(state, gboard.rows);
+    uint64_t y = next_random(state, gboard.columns);
 
-    gbox * loc = &GET_LOC(x,y);
+    gbox * loc = &board[(x + 1) * gboard.stride + y + 1];
     if(loc->box_type != BOX_TYPE_MINE)
     {
-      
       loc->box_type = BOX_TYPE_MINE;
-      gboard.mines[i] = (gbox*)&loc;
+      mines[i] = loc - board;
       i++;
-    } else continue;
+    }
   }
+}
 
-  
+/**
+ * 3BV of a board nobody has touched yet: the fewest clicks that clear
+ * it, one per opening plus one per number no opening reaches.
+ * is_revealed is borrowed as the visited mark and cleared again after.
+ * Returns 0 if the stack couldn't grow.
+ */
+uint64_t rate_board(gbox * board, uint64_t ** stack, uint64_t * cap)
+{
+  uint64_t bbbv = 0, end = (gboard.rows + 1) * gboard.stride;
+  bool ok = true;
 
-  return 0;
-}
+  if(!*cap)
+  {
+    *stack = (uint64_t *)malloc(sizeof(uint64_t) * 1024);
+    if(*stack) *cap = 1024;
+  }
+  if(!*stack) return 0;
+
+  for(uint64_t idx = gboard.stride; idx < end && ok; idx++)
+  {
+    // sentinels and mines both fail the first test
+    if(board[idx].box_type != BOX_TYPE_EMPTY || board[idx].num_mines_around || board[idx].is_revealed) continue;
+
+    bbbv++;
+    uint64_t top = 0;
+    board[idx].is_revealed = true;
+    (*stack)[top++] = idx;
+    while(top)
+    {
+      uint64_t cur = (*stack)[--top];
+      if(board[cur].num_mines_around) continue;
+
+      if(*cap - top < 8)
+      {
+        uint64_t * grown = (uint64_t *)realloc(*stack, sizeof(uint64_t) * *cap * 2);
+        if(!grown)
+        {
+          ok = false;
+          break;
+        }
+        *stack = grown;
+        *cap *= 2;
+      }
+
+      // nothing next to a zero is a mine
+      for(int i = 0; i < gboard.num_neighbors; i++)
+      {
+        uint64_t n = cur + gboard.neighbors[i];
+        if(board[n].is_revealed) continue;
+        if(board[n].box_type == BOX_TYPE_SENTINEL)
+        {
+          n = torus_wrap(n);
+          if(board[n].is_revealed) continue;
+        }
+        board[n].is_revealed = true;
+        (*stack)[top++] = n;
+      }
+    }
+  }
 
+  for(uint64_t r = 1; r <= gboard.rows; r++)
+  {
+    for(uint64_t c = 1; c <= gboard.columns; c++)
+    {
+      gbox * loc = &board[r * gboard.stride + c];
+      if(loc->box_type == BOX_TYPE_EMPTY && !loc->is_revealed) bbbv++;
+      loc->is_revealed = false;
+    }
+  }
+  return ok ? bbbv : 0;
+}
 
-void init_board(unsigned int num_cols, unsigned int num_rows)
+int init_board(uint64_t num_cols, uint64_t num_rows, int topology)
 {
-  gboard.board = (gbox *)malloc(sizeof(gbox) * (num_cols * num_rows));
-  memset(gboard.board, 0, sizeof(gbox) * (num_cols * num_rows));
+  uint64_t size, padded;
+  if(__builtin_mul_overflow(num_cols, num_rows, &size) ||
+     num_cols > UINT64_MAX - 2 || num_rows > UINT64_MAX - 2 ||
+     __builtin_mul_overflow(num_cols + 2, num_rows + 2, &padded) ||
+     padded > SIZE_MAX / sizeof(gbox))
+    return -1;
+
+  // calloc hands back zeroed pages, which is an empty board already
+  gboard.board = (gbox *)calloc(padded, sizeof(gbox));
+  if(!gboard.board) return -1;
+
   gboard.columns = num_cols;
   gboard.rows = num_rows;
+  gboard.stride = num_cols + 2;
+  gboard.size = size;
+  gboard.topology = topology;
+
+  int64_t s = gboard.stride;
+  if(topology == TOPOLOGY_HEX)
+  {
+    /**
+     * Axial coordinates: each row is the one above it shifted half a box
+     * to the right, so the six neighbors are fixed offsets as well.
+     *
+     *       o o
+     *      o @ o
+     *       o o
+     */
+    const int64_t hex[6] = { -s, -s + 1, -1, 1, s - 1, s };
+    memcpy(gboard.neighbors, hex, sizeof(hex));
+    gboard.num_neighbors = 6;
+  }
+  else
+  {
+    const int64_t square[8] = { -s - 1, -s, -s + 1, -1, 1, s - 1, s, s + 1 };
+    memcpy(gboard.neighbors, square, sizeof(square));
+    gboard.num_neighbors = 8;
+  }
+
+  init_ring(gboard.board);
+  return region_init();
+}
+
+// the sentinel ring around a board of gboard's shape
+void init_ring(gbox * board)
+{
+  bool sentinel_revealed = gboard.topology != TOPOLOGY_TORUS;
+  uint64_t last = gboard.rows + 1;
+  for(uint64_t c = 0; c < gboard.stride; c++)
+  {
+    board[c] = (gbox){ BOX_TYPE_SENTINEL, 0, sentinel_revealed, false };
+    board[last * gboard.stride + c] = (gbox){ BOX_TYPE_SENTINEL, 0, sentinel_revealed, false };
+  }
+  for(uint64_t r = 1; r < last; r++)
+  {
+    board[r * gboard.stride] = (gbox){ BOX_TYPE_SENTINEL, 0, sentinel_revealed, false };
+    board[r * gboard.stride + gboard.columns + 1] = (gbox){ BOX_TYPE_SENTINEL, 0, sentinel_revealed, false };
+  }
+}
+
+// back to an empty board of the same shape, keeping the allocation
+void clear_board()
+{
+  memset(gboard.board, 0, sizeof(gbox) * gboard.stride * (gboard.rows + 2));
+  init_ring(gboard.board);
+}
 
-  gboard.size = num_cols * num_rows;
-  for(int row = 0; row < gboard.rows; row++)
+static bool pregen_push(pregen_ring * ring, pregen_board * b)
+{
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  if(head - atomic_load_explicit(&ring->tail, memory_order_acquire) == PREGEN_MAX_DEPTH) return false;
+  ring->slots[head % PREGEN_MAX_DEPTH] = b;
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  return true;
+}
+
+static pregen_board * pregen_pop(pregen_ring * ring)
+{
+  uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  if(tail == atomic_load_explicit(&ring->head, memory_order_acquire)) return NULL;
+  pregen_board * b = ring->slots[tail % PREGEN_MAX_DEPTH];
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+  return b;
+}
+
+/**
+ * Starts the next game in the memory, window and terminal the last one
+ * used. With a producer running that is swapping in a board it already
+ * dealt; otherwise the old board is cleared and dealt again here.
+ */
+void new_game()
+{
+  pregen_board * next = pregen_depth ? pregen_pop(&pregen_ready) : NULL;
+  if(next)
+  {
+    // the finished board goes back to the producer to be cleared
+    gbox * board = gboard.board;
+    uint64_t * mines = gboard.mines;
+    gboard.board = next->board;
+    gboard.mines = next->mines;
+    gboard.seed = next->seed;
+    gboard.bbbv = next->bbbv;
+    next->board = board;
+    next->mines = mines;
+    pregen_push(&pregen_spare, next);
+    sem_post(&pregen_wake);
+  }
+  else
+  {
+    clear_board();
+    seed_random();
+    gboard.seed = random_state;
+    deal_mines(gboard.board, gboard.mines, gboard.number_mines, &random_state);
+    get_surrounding_mines();
+    gboard.bbbv = gboard.size <= RATE_MAX_BOXES ? rate_board(gboard.board, &flood_stack, &flood_stack_cap) : 0;
+  }
+
+  region_clear();
+  gboard.num_places_revealed = 0;
+  gboard.flags_placed = 0;
+  gboard.num_mines_flagged = 0;
+  observe_reset();
+  hint_clear();
+  game_result = GAME_PLAYING;
+  game_clicks = 0;
+  game_flags = 0;
+  fatal_box = CMT_NO_BOX;
+}
+
+/**
+ * Producer thread: takes a spare board, clears it, deals it from its own
+ * random state, counts and rates it, and queues it for new_game(). It
+ * runs as SCHED_IDLE, so it only gets the CPU nobody else wants, and
+ * sleeps on pregen_wake while every board is ready and waiting.
+ */
+static void * pregen_main(void * arg)
+{
+  struct sched_param param = { 0 };
+  pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+
+  uint64_t * stack = NULL, cap = 0;
+  for(;;)
+  {
+    while(sem_wait(&pregen_wake) == -1 && errno == EINTR);
+    if(atomic_load(&pregen_stopping)) break;
+
+    pregen_board * b = pregen_pop(&pregen_spare);
+    if(!b) continue;
+    memset(b->board, 0, sizeof(gbox) * gboard.stride * (gboard.rows + 2));
+    init_ring(b->board);
+    b->seed = pregen_state;
+    deal_mines(b->board, b->mines, gboard.number_mines, &pregen_state);
+    count_mines(b->board, b->mines);
+    b->bbbv = rate_board(b->board, &stack, &cap);
+    pregen_push(&pregen_ready, b);
+  }
+  free(stack);
+  return NULL;
+}
+
+/**
+ * Starts dealing boards of the current shape ahead of time, as many as
+ * fit in PREGEN_MEMORY up to PREGEN_MAX_DEPTH. Big boards get none and
+ * keep restarting in place.
+ */
+int pregen_start()
+{
+  uint64_t padded = gboard.stride * (gboard.rows + 2);
+  uint64_t bytes = padded * sizeof(gbox) + (gboard.number_mines + 1) * sizeof(uint64_t);
+  uint64_t depth = PREGEN_MEMORY / bytes;
+  if(depth > PREGEN_MAX_DEPTH) depth = PREGEN_MAX_DEPTH;
+
+  atomic_store(&pregen_ready.head, 0);
+  atomic_store(&pregen_ready.tail, 0);
+  atomic_store(&pregen_spare.head, 0);
+  atomic_store(&pregen_spare.tail, 0);
+  for(pregen_depth = 0; pregen_depth < (int)depth; pregen_depth++)
   {
-    for(int col = 0; col < gboard.columns; col++)
+    pregen_board * b = &pregen_boards[pregen_depth];
+    b->board = (gbox *)malloc(sizeof(gbox) * padded);
+    b->mines = (uint64_t *)malloc(sizeof(uint64_t) * (gboard.number_mines + 1));
+    if(!b->board || !b->mines)
     {
-      gbox * cloc = &GET_LOC(row, col);
-      cloc->box_type = 0;
-      cloc->num_mines_around = 0;
+      free(b->board);
+      free(b->mines);
+      break;
     }
-  } 
+    pregen_push(&pregen_spare, b);
+  }
+
+  pregen_state = get_random_number(UINT64_MAX) | 1;
+  atomic_store(&pregen_stopping, false);
+  if(!pregen_depth || sem_init(&pregen_wake, 0, pregen_depth) == -1 ||
+     pthread_create(&pregen_thread, NULL, pregen_main, NULL) != 0)
+  {
+    for(int i = 0; i < pregen_depth; i++)
+    {
+      free(pregen_boards[i].board);
+      free(pregen_boards[i].mines);
+    }
+    pregen_depth = 0;
+    return -1;
+  }
+  return 0;
+}
+
+void pregen_stop()
+{
+  if(!pregen_depth) return;
+  atomic_store(&pregen_stopping, true);
+  sem_post(&pregen_wake);
+  pthread_join(pregen_thread, NULL);
+  sem_destroy(&pregen_wake);
+
+  for(int i = 0; i < pregen_depth; i++)
+  {
+    free(pregen_boards[i].board);
+    free(pregen_boards[i].mines);
+  }
+  pregen_depth = 0;
 }
 
 void free_board()
 {
   if(gboard.board) free(gboard.board);
   if(gboard.mines) free(gboard.mines);
+  if(flood_stack) free(flood_stack);
+  region_free();
+  gboard.board = NULL;
+  gboard.mines = NULL;
+  flood_stack = NULL;
+  flood_stack_cap = 0;
 }
 
 
-unsigned int get_random_number(unsigned int max)
+/**
+ * Uniform-ish number in [0, max). /dev/urandom is only read once for the
+ * seed; after that it is xorshift64*, since a fread per mine is what made
+ * big boards slow to generate.
+ */
+uint64_t get_random_number(uint64_t max)
 {
-  if(!random_number_bag)
+  seed_random();
+  return next_random(&random_state, max);
+}
+
+void seed_random()
+{
+  if(!random_state)
   {
-    random_number_bag = fopen("/dev/urandom","rb");
-    return get_random_number(max);
+    if(!random_number_bag) random_number_bag = fopen("/dev/urandom","rb");
+    if(!random_number_bag || fread(&random_state, 1, sizeof(random_state), random_number_bag) != sizeof(random_state))
+      random_state = (uint64_t)time(NULL);
+    if(!random_state) random_state = 1;
   }
+}
 
-  unsigned int num;
-  fread(&num, 1, sizeof(num),random_number_bag);
-  srand(num);
+// the generator itself, on any state, so other threads can keep their own
+uint64_t next_random(uint64_t * state, uint64_t max)
+{
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
 
-  return rand() % max;
+  return ((unsigned __int128)(x * 0x2545F4914F6CDD1DULL) * max) >> 64;
 }
 
 
-
+// text grid through the exporter, stdout is usually a pipe or a file
 void debug_dump_board_info()
 {
-  for(int row = 0; row < gboard.rows; row++)
+  export_board(STDOUT_FILENO, EXPORT_TEXT);
+}
+
+/**
+ * Board export.
+ *
+ * Everything goes through one EXPORT_BUFFER_SIZE buffer that is filled a
+ * row at a time and handed to write() whenever the next row might not
+ * fit, so memory stays bounded by max(buffer, one row) no matter how big
+ * the board is.
+ *
+ * Formats:
+ *  text - one character per box ('*' mine, 'o' empty, '1'-'8'), one line per row
+ *  pbm  - binary P4 bitmap, black pixel for each mine
+ *  pgm  - binary P5 graymap, 0-8 surrounding mines and 9 for a mine
+ *  rle  - "CMRLE <rows> <cols> <mines>\n" followed by, for every mine in
+ *         row-major order, the number of empty boxes before it since the
+ *         previous mine as an unsigned LEB128 varint
+ */
+
+typedef struct export_buffer
+{
+  int fd;
+  unsigned char * data;
+  size_t len;
+  size_t cap;
+  bool failed;
+} export_buffer;
+
+static void export_flush(export_buffer * out)
+{
+  size_t off = 0;
+  while(off < out->len && !out->failed)
+  {
+    ssize_t n = write(out->fd, out->data + off, out->len - off);
+    if(n == -1 && errno == EINTR) continue;
+    if(n <= 0) out->failed = true;
+    else off += n;
+  }
+  out->len = 0;
+}
+
+// flush now unless `len` more bytes are guaranteed to fit
+static void export_reserve(export_buffer * out, size_t len)
+{
+  if(out->len + len > out->cap) export_flush(out);
+}
+
+static void export_put_varint(export_buffer * out, unsigned long long value)
+{
+  while(value >= 0x80)
+  {
+    out->data[out->len++] = (value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  out->data[out->len++] = value;
+}
+
+int parse_export_format(const char * name)
+{
+  if(strcmp(name, "text") == 0) return EXPORT_TEXT;
+  if(strcmp(name, "pbm") == 0) return EXPORT_PBM;
+  if(strcmp(name, "pgm") == 0) return EXPORT_PGM;
+  if(strcmp(name, "rle") == 0) return EXPORT_RLE;
+  return -1;
+}
+
+int export_board(int fd, int format)
+{
+  export_buffer out = { .fd = fd };
+  size_t row_bytes;
+
+  // worst case a single row can add
+  switch(format)
+  {
+    case EXPORT_TEXT: row_bytes = gboard.columns + 1; break;
+    case EXPORT_PBM:  row_bytes = (gboard.columns + 7) / 8; break;
+    case EXPORT_PGM:  row_bytes = gboard.columns; break;
+    case EXPORT_RLE:  row_bytes = (size_t)gboard.columns * 10; break;
+    default: return -1;
+  }
+
+  out.cap = row_bytes > EXPORT_BUFFER_SIZE ? row_bytes : EXPORT_BUFFER_SIZE;
+  out.data = malloc(out.cap);
+  if(!out.data) return -1;
+
+  const char * header_fmt = NULL;
+  if(format == EXPORT_PBM) header_fmt = "P4\n%" PRIu64 " %" PRIu64 "\n";
+  else if(format == EXPORT_PGM) header_fmt = "P5\n%" PRIu64 " %" PRIu64 "\n9\n";
+  if(header_fmt)
+    out.len = snprintf((char *)out.data, out.cap, header_fmt, gboard.columns, gboard.rows);
+  else if(format == EXPORT_RLE)
+    out.len = snprintf((char *)out.data, out.cap, "CMRLE %" PRIu64 " %" PRIu64 " %" PRIu64 "\n", gboard.rows, gboard.columns, gboard.number_mines);
+
+  unsigned long long gap = 0;
+  for(uint64_t row = 0; row < gboard.rows && !out.failed; row++)
   {
-    for(int col = 0; col < gboard.columns; col++)
+    export_reserve(&out, row_bytes);
+    const gbox * loc = &GET_LOC(row, 0);
+    unsigned char * dst = out.data + out.len;
+
+    switch(format)
     {
-        
-      gbox * loc = &GET_LOC(row,col);
-      // printf("%d\n",loc->box_type);
-      
-      if(loc->box_type == BOX_TYPE_MINE){
-        printf("\033[31m* \033[0m");
-      }
-      else if(loc->box_type == BOX_TYPE_EMPTY) {
-        if(loc->num_mines_around == 0)
-          printf("o " );
-        else 
-          printf("%d ",loc->num_mines_around);
-      }
-      
+      case EXPORT_TEXT:
+        for(uint64_t col = 0; col < gboard.columns; col++, loc++)
+        {
+          if(loc->box_type == BOX_TYPE_MINE) *dst++ = '*';
+          else if(loc->num_mines_around == 0) *dst++ = 'o';
+          else *dst++ = '0' + loc->num_mines_around;
+        }
+        *dst++ = '\n';
+        out.len = dst - out.data;
+        break;
+      case EXPORT_PBM:
+        memset(dst, 0, row_bytes);
+        for(uint64_t col = 0; col < gboard.columns; col++, loc++)
+          if(loc->box_type == BOX_TYPE_MINE) dst[col >> 3] |= 0x80 >> (col & 7);
+        out.len += row_bytes;
+        break;
+      case EXPORT_PGM:
+        for(uint64_t col = 0; col < gboard.columns; col++, loc++)
+          *dst++ = loc->box_type == BOX_TYPE_MINE ? 9 : loc->num_mines_around;
+        out.len = dst - out.data;
+        break;
+      case EXPORT_RLE:
+        for(uint64_t col = 0; col < gboard.columns; col++, loc++)
+        {
+          if(loc->box_type != BOX_TYPE_MINE)
+          {
+            gap++;
+            continue;
+          }
+          export_put_varint(&out, gap);
+          gap = 0;
+        }
+        break;
     }
-    // printf("\n");
-    // for(int col = 0; col < columns * 4 + 1; col++)
-    //   printf("-");
-    printf("\n");
   }
 
+  export_flush(&out);
+  free(out.data);
+  return out.failed ? -1 : 0;
 }
 
-void get_surrounding_mines(unsigned int row, unsigned int col)
+void get_surrounding_mines()
 {
-  for(int r = 0; r < row; r++)
+  count_mines(gboard.board, gboard.mines);
+}
+
+// fills in num_mines_around on a freshly dealt board of gboard's shape
+void count_mines(gbox * board, const uint64_t * mines)
+{
+  uint64_t row = gboard.rows, col = gboard.columns;
+
+  // only the mines add to counts, so walk the mine list instead of the board
+  for(uint64_t i = 0; i < gboard.number_mines; i++)
+    calculate_surrounding_mines(board, mines[i]);
+
+  if(gboard.topology != TOPOLOGY_TORUS) return;
+
+  // counts that landed on the ring belong to the box on the far edge
+  for(uint64_t r = 0; r < row + 2; r++)
   {
-    for(int c = 0; c < col; c++)
+    for(uint64_t c = 0; c < col + 2; c++)
     {
-      
-      gbox * curloc = &GET_LOC(r,c);
-      if(curloc->box_type == BOX_TYPE_MINE)
-        calculate_surrounding_mines(curloc, r, c);
-      
+      if(r != 0 && r != row + 1 && c != 0 && c != col + 1) c = col + 1;
+      gbox * ghost = &board[r * gboard.stride + c];
+      board[torus_wrap(r * gboard.stride + c)].num_mines_around += ghost->num_mines_around;
+      ghost->num_mines_around = 0;
     }
   }
 }
 
 
 
-
-int calculate_surrounding_mines(const gbox * const loc, unsigned int row, unsigned int col)
+void calculate_surrounding_mines(gbox * board, uint64_t idx)
 {
-  int num_mines_found = 0;
-  if(loc->box_type == BOX_TYPE_EMPTY) return num_mines_found;
-
   /**
    * Assuming the current loc is @, we look here:
    * 
@@ -325,73 +1172,491 @@ int calculate_surrounding_mines(const gbox * const loc, unsigned int row, unsign
    *      o @ o   ((row, col-1),    (row, col),    (row, col+1))
    *      o o o   ((row+1,col-1),   (row+1, col),  (row+1,col+1))
    * 
+   * The sentinel ring means the corners and edges need no special case:
+   * whatever lands on the ring is never shown (or is folded back on a torus).
    */
+  for(int i = 0; i < gboard.num_neighbors; i++)
+    board[idx + gboard.neighbors[i]].num_mines_around++;
+}
 
+/**
+ * Maps a ring index on a torus to the real box it stands in for, i.e.
+ * the one on the opposite edge. Only called for sentinels, which on a
+ * torus are the only unrevealed boxes that aren't real.
+ */
+uint64_t torus_wrap(uint64_t idx)
+{
+  uint64_t r = idx / gboard.stride;
+  uint64_t c = idx % gboard.stride;
 
-  for(int i = 0; i < 8; i++)
-  {
-    int nx = neighbor_map[i][0];
-    int ny = neighbor_map[i][1];
-    int ncol = col + nx;
-    int nrow = row + ny;
-    /**
-     const gbox * current_loc = &GET_LOC(ncol, nrow);
-      if(current_loc->box_type == BOX_TYPE_MINE) num_mines_found++;
-
-     * 
-     */
+  if(r == 0) r = gboard.rows;
+  else if(r == gboard.rows + 1) r = 1;
+  if(c == 0) c = gboard.columns;
+  else if(c == gboard.columns + 1) c = 1;
 
-    if(nrow >= 0 && nrow <= gboard.rows -1&& ncol >= 0 && ncol <= gboard.columns-1)
-    {
-      gbox * loc = &GET_LOC(nrow, ncol);
-      loc->num_mines_around++; 
+  return r * gboard.stride + c;
+}
 
-    }
+int region_init()
+{
+  region_tree * t = &gboard.regions;
+  for(int l = 0; l < REGION_MAX_LEVELS; l++)
+  {
+    int shift = REGION_BASE_SHIFT + l;
+    t->rows[l] = ((gboard.rows - 1) >> shift) + 1;
+    t->columns[l] = ((gboard.columns - 1) >> shift) + 1;
+    t->tiles[l] = (region_tile *)calloc(t->rows[l] * t->columns[l], sizeof(region_tile));
+    if(!t->tiles[l]) return -1;
+    t->num_levels = l + 1;
+    if(t->rows[l] == 1 && t->columns[l] == 1) break;
   }
+  return 0;
+}
 
-  
-  
-  
-
-  return num_mines_found;
+void region_free()
+{
+  region_tree * t = &gboard.regions;
+  for(int l = 0; l < t->num_levels; l++) free(t->tiles[l]);
+  t->num_levels = 0;
 }
 
-void init_window()
+// box idx (a padded index) gained or lost a reveal or a flag
+void region_add(uint64_t idx, int64_t revealed, int64_t flagged)
 {
-	printf("\n%dx%d",LINES, COLS);
-	if(COLS >= gboard.columns  && LINES >= gboard.rows )
-	{
-		
-		gamewindow = newwin(gboard.rows * 2, gboard.columns * 2, 3, 3);
-		refresh();
-	} else {
-		printf("Screen width must be greater than or equal to %dx%d.\n",gboard.rows * 2, gboard.columns * 2);
-		cleanup();
-		exit(1);
-	}
+  region_tree * t = &gboard.regions;
+  uint64_t r = idx / gboard.stride - 1, c = idx % gboard.stride - 1;
+
+  for(int l = 0; l < t->num_levels; l++)
+  {
+    int shift = REGION_BASE_SHIFT + l;
+    region_tile * tile = &t->tiles[l][(r >> shift) * t->columns[l] + (c >> shift)];
+    tile->revealed += (uint64_t)revealed;
+    tile->flagged += (uint64_t)flagged;
+  }
 }
 
-void cleanup()
+void region_clear()
 {
+  region_tree * t = &gboard.regions;
+  for(int l = 0; l < t->num_levels; l++)
+    memset(t->tiles[l], 0, sizeof(region_tile) * t->rows[l] * t->columns[l]);
+}
+
+// recomputes every level above the leaves from the leaves
+void region_rebuild()
+{
+  region_tree * t = &gboard.regions;
+  for(int l = 1; l < t->num_levels; l++)
+  {
+    memset(t->tiles[l], 0, sizeof(region_tile) * t->rows[l] * t->columns[l]);
+    for(uint64_t r = 0; r < t->rows[l - 1]; r++)
+    {
+      for(uint64_t c = 0; c < t->columns[l - 1]; c++)
+      {
+        const region_tile * below = &t->tiles[l - 1][r * t->columns[l - 1] + c];
+        region_tile * tile = &t->tiles[l][(r / 2) * t->columns[l] + c / 2];
+        tile->revealed += below->revealed;
+        tile->flagged += below->flagged;
+      }
+    }
+  }
+}
+
+// the boxes tile (tr, tc) of a level covers, cut down to the board
+static void region_bounds(int level, uint64_t tr, uint64_t tc, uint64_t * top, uint64_t * left, uint64_t * bottom, uint64_t * right)
+{
+  int shift = REGION_BASE_SHIFT + level;
+  *top = tr << shift;
+  *left = tc << shift;
+  *bottom = gboard.rows - *top > (1ULL << shift) ? *top + (1ULL << shift) : gboard.rows;
+  *right = gboard.columns - *left > (1ULL << shift) ? *left + (1ULL << shift) : gboard.columns;
+}
+
+static void region_sum(int level, uint64_t tr, uint64_t tc, uint64_t r0, uint64_t c0, uint64_t r1, uint64_t c1, region_tile * out)
+{
+  uint64_t top, left, bottom, right;
+  region_bounds(level, tr, tc, &top, &left, &bottom, &right);
+  if(bottom <= r0 || top >= r1 || right <= c0 || left >= c1) return;
+
+  if(top >= r0 && bottom <= r1 && left >= c0 && right <= c1)
+  {
+    const region_tile * tile = &gboard.regions.tiles[level][tr * gboard.regions.columns[level] + tc];
+    out->revealed += tile->revealed;
+    out->flagged += tile->flagged;
+    return;
+  }
+
+  if(level == 0)
+  {
+    for(uint64_t r = top > r0 ? top : r0; r < bottom && r < r1; r++)
+    {
+      for(uint64_t c = left > c0 ? left : c0; c < right && c < c1; c++)
+      {
+        out->revealed += GET_LOC(r, c).is_revealed;
+        out->flagged += GET_LOC(r, c).is_flagged;
+      }
+    }
+    return;
+  }
+
+  for(uint64_t r = tr * 2; r < tr * 2 + 2 && r < gboard.regions.rows[level - 1]; r++)
+    for(uint64_t c = tc * 2; c < tc * 2 + 2 && c < gboard.regions.columns[level - 1]; c++)
+      region_sum(level - 1, r, c, r0, c0, r1, c1, out);
+}
+
+/**
+ * Revealed and flagged boxes in rows [r0, r1) and columns [c0, c1).
+ * Whole tiles come straight from the tree, only boxes in a leaf tile
+ * the edge of the rectangle cuts through are looked at one by one, so
+ * the cost goes with the rectangle's perimeter rather than its area and
+ * the whole board is a single lookup.
+ */
+void region_count(uint64_t r0, uint64_t c0, uint64_t r1, uint64_t c1, region_tile * out)
+{
+  out->revealed = 0;
+  out->flagged = 0;
+  if(r1 > gboard.rows) r1 = gboard.rows;
+  if(c1 > gboard.columns) c1 = gboard.columns;
+  if(r0 >= r1 || c0 >= c1 || !gboard.regions.num_levels) return;
+  region_sum(gboard.regions.num_levels - 1, 0, 0, r0, c0, r1, c1, out);
+}
+
+/**
+ * The board window is as big as the board where the terminal allows and
+ * otherwise takes what is left of the terminal; nc_print_board() then
+ * scrolls it to follow the cursor. All it needs is room for one box.
+ */
+void init_window()
+{
+	printf("\n%dx%d",LINES, COLS);
+	// newwin() below fails outright if the window doesn't fit
+	if(COLS >= 3 + 2 && LINES >= 3 + 1)
+	{
+		uint64_t height = gboard.rows * 2;
+		uint64_t width = gboard.columns * 2 + (gboard.topology == TOPOLOGY_HEX ? gboard.rows : 0);
+		if(height > (uint64_t)LINES - 3) height = LINES - 3;
+		if(width > (uint64_t)COLS - 3) width = COLS - 3;
+		gamewindow = newwin(height, width, 3, 3);
+		refresh();
+	} else {
+		cleanup();
+		printf("Screen width must be greater than or equal to 4x5.\n");
+		exit(1);
+	}
+}
+
+void cleanup()
+{
+	pregen_stop();
 	if(random_number_bag) fclose(random_number_bag);
 	if(gamewindow) delwin(gamewindow);
+	if(clockwindow) delwin(clockwindow);
 	endwin();
+	observe_close();
+	telemetry_close();
 	free_board();
 }
 
-// TODO: Actually implement this
-void gameover()
+// 'q' or a quitting signal; a game still being played is logged as abandoned
+__attribute__((noreturn)) void quit_game(int code)
 {
-  cleanup();
-  printf("Sorry, you lost :(\n");
-  exit(1);
+	if(game_result == GAME_PLAYING)
+	{
+		game_finished = now_ms();
+		telemetry_game(CMT_RESULT_ABANDONED);
+	}
+	cleanup();
+	exit(code);
+}
+
+// a quitting signal is waiting on signal_fd
+void quit_on_signal()
+{
+	struct signalfd_siginfo info;
+	if(read(signal_fd, &info, sizeof(info)) != sizeof(info)) return;
+	quit_game(128 + info.ssi_signo);
+}
+
+// the move that hit mine idx stops here, movement_handler() takes it from there
+void gameover(uint64_t idx)
+{
+  game_result = GAME_LOST;
+  fatal_box = idx;
+  observe_gameover(CMO_GAME_LOST);
+}
+
+/**
+ * Spectator segment, see cmobserve.h for the layout. Everything here is
+ * a no-op unless the game was started with `observe <name>`.
+ */
+int observe_open(const char * name)
+{
+  uint64_t padded = gboard.stride * (gboard.rows + 2);
+  size_t ring_off = (sizeof(cmo_header) + padded + 63) & ~(size_t)63;
+  size_t len = ring_off + sizeof(cmo_event) * OBSERVE_RING_SIZE;
+
+  snprintf(observer_name, sizeof(observer_name), "%s%s", name[0] == '/' ? "" : "/", name);
+  // never share a live game's segment with a second one of the same name
+  int fd = shm_open(observer_name, O_CREAT | O_EXCL | O_RDWR, 0644);
+  if(fd == -1) return -1;
+  if(ftruncate(fd, len) == -1)
+  {
+    close(fd);
+    shm_unlink(observer_name);
+    return -1;
+  }
+
+  void * mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(mem == MAP_FAILED)
+  {
+    shm_unlink(observer_name);
+    return -1;
+  }
+
+  observer = mem;
+  observer_len = len;
+  observer_plane = (uint8_t *)mem + sizeof(cmo_header);
+  observer_ring = (cmo_event *)((uint8_t *)mem + ring_off);
+
+  for(uint64_t idx = 0; idx < padded; idx++)
+    observer_plane[idx] = gboard.board[idx].box_type == BOX_TYPE_SENTINEL ? CMO_CELL_OFFBOARD : CMO_CELL_HIDDEN;
+
+  observer->rows = gboard.rows;
+  observer->columns = gboard.columns;
+  observer->stride = gboard.stride;
+  observer->padded_size = padded;
+  observer->topology = gboard.topology;
+  observer->number_mines = gboard.number_mines;
+  observer->ring_capacity = OBSERVE_RING_SIZE;
+  observer->plane_offset = sizeof(cmo_header);
+  observer->ring_offset = ring_off;
+  atomic_store_explicit(&observer->game_state, CMO_GAME_PLAYING, memory_order_relaxed);
+  observer->version = CMO_VERSION;
+  // readers check the magic last, so it goes in once the rest is there
+  atomic_thread_fence(memory_order_release);
+  observer->magic = CMO_MAGIC;
+  return 0;
+}
+
+void observe_close()
+{
+  if(!observer) return;
+  observe_counters(CMO_GAME_CLOSED);
+  munmap(observer, observer_len);
+  shm_unlink(observer_name);
+  observer = NULL;
+}
+
+/**
+ * A new game on the same board. The plane is rewritten in place rather
+ * than through the ring, a spectator that was following along sees the
+ * counters drop back to zero and resyncs from the plane.
+ */
+void observe_reset()
+{
+  if(!observer) return;
+  for(uint64_t r = 1; r <= gboard.rows; r++)
+    for(uint64_t c = 1; c <= gboard.columns; c++)
+      __atomic_store_n(&observer_plane[r * gboard.stride + c], CMO_CELL_HIDDEN, __ATOMIC_RELAXED);
+  observe_counters(CMO_GAME_PLAYING);
+}
+
+// writes box idx to the plane and appends it to the event ring
+void observe_box(uint64_t idx, uint8_t value)
+{
+  __atomic_store_n(&observer_plane[idx], value, __ATOMIC_RELAXED);
+
+  uint64_t n = atomic_load_explicit(&observer->ring_head, memory_order_relaxed);
+  cmo_event * slot = &observer_ring[n & (OBSERVE_RING_SIZE - 1)];
+
+  atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&slot->event, idx << 8 | value, memory_order_relaxed);
+  atomic_store_explicit(&slot->seq, n + 1, memory_order_release);
+  atomic_store_explicit(&observer->ring_head, n + 1, memory_order_release);
+}
+
+void observe_counters(int state)
+{
+  if(!observer) return;
+
+  uint64_t seq = atomic_load_explicit(&observer->seq, memory_order_relaxed);
+  atomic_store_explicit(&observer->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&observer->num_places_revealed, gboard.num_places_revealed, memory_order_relaxed);
+  atomic_store_explicit(&observer->flags_placed, gboard.flags_placed, memory_order_relaxed);
+  atomic_store_explicit(&observer->num_mines_flagged, gboard.num_mines_flagged, memory_order_relaxed);
+  atomic_store_explicit(&observer->game_state, state, memory_order_relaxed);
+  atomic_store_explicit(&observer->seq, seq + 2, memory_order_release);
+}
+
+// the mines only go in the plane once they're no secret
+void observe_gameover(int state)
+{
+  if(!observer) return;
+  if(state == CMO_GAME_LOST)
+    for(uint64_t i = 0; i < gboard.number_mines; i++)
+      observe_box(gboard.mines[i], CMO_CELL_MINE);
+  observe_counters(state);
+}
+
+/**
+ * Telemetry, see cmtelemetry.h. A finished game is one record copied
+ * into telemetry_buf; the file sees a write() whenever movement_handler()
+ * is about to wait on the player, and otherwise every TELEMETRY_BATCH
+ * games or TELEMETRY_FLUSH_MS, whichever comes first, so games restarted
+ * back to back still share writes. Everything here is a no-op unless the
+ * game was started with `telemetry <file>`.
+ */
+int telemetry_open(const char * path)
+{
+  snprintf(telemetry_path, sizeof(telemetry_path), "%s", path);
+  telemetry_fd = open(telemetry_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if(telemetry_fd == -1) return -1;
+
+  struct stat st;
+  telemetry_buf = (cmt_record *)malloc(sizeof(cmt_record) * TELEMETRY_BATCH);
+  if(!telemetry_buf || fstat(telemetry_fd, &st) == -1)
+  {
+    telemetry_close();
+    return -1;
+  }
+  telemetry_size = st.st_size;
+  telemetry_flushed = now_ms();
+  return telemetry_header();
+}
+
+// a new file starts with its header so that it is readable while empty
+int telemetry_header()
+{
+  if(telemetry_size) return 0;
+
+  cmt_file_header header = { CMT_MAGIC, CMT_VERSION, sizeof(cmt_record), 0 };
+  ssize_t n;
+  while((n = write(telemetry_fd, &header, sizeof(header))) == -1 && errno == EINTR);
+  if(n != sizeof(header))
+  {
+    telemetry_close();
+    return -1;
+  }
+  telemetry_size = sizeof(header);
+  return 0;
+}
+
+void telemetry_game(int result)
+{
+  if(telemetry_fd == -1) return;
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  uint64_t duration = game_finished - game_started;
+  uint64_t now = ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+
+  telemetry_buf[telemetry_len++] = (cmt_record){
+    .seed = gboard.seed,
+    .started_ms = now - duration,
+    .rows = gboard.rows,
+    .columns = gboard.columns,
+    .mines = gboard.number_mines,
+    .bbbv = gboard.bbbv,
+    .fatal_row = fatal_box == CMT_NO_BOX ? CMT_NO_BOX : fatal_box / gboard.stride - 1,
+    .fatal_col = fatal_box == CMT_NO_BOX ? CMT_NO_BOX : fatal_box % gboard.stride - 1,
+    .duration_ms = duration > UINT32_MAX ? UINT32_MAX : duration,
+    .clicks = game_clicks,
+    .flags = game_flags,
+    .preset = game_preset,
+    .topology = gboard.topology,
+    .result = result
+  };
+  if(telemetry_len == TELEMETRY_BATCH || game_finished - telemetry_flushed >= TELEMETRY_FLUSH_MS) telemetry_flush();
+}
+
+// moves <file> to <file>.1, <file>.1 to <file>.2 and so on, dropping the last
+static void telemetry_rotate()
+{
+  char from[sizeof(telemetry_path) + 16], to[sizeof(telemetry_path) + 16];
+  for(int i = TELEMETRY_KEEP - 1; i >= 1; i--)
+  {
+    snprintf(from, sizeof(from), "%s.%d", telemetry_path, i);
+    snprintf(to, sizeof(to), "%s.%d", telemetry_path, i + 1);
+    rename(from, to);
+  }
+  snprintf(to, sizeof(to), "%s.1", telemetry_path);
+  rename(telemetry_path, to);
+
+  close(telemetry_fd);
+  telemetry_fd = open(telemetry_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  telemetry_size = 0;
+  if(telemetry_fd != -1) telemetry_header();
+}
+
+void telemetry_flush()
+{
+  telemetry_flushed = now_ms();
+  if(telemetry_fd == -1 || !telemetry_len) return;
+
+  const char * data = (const char *)telemetry_buf;
+  size_t left = sizeof(cmt_record) * telemetry_len;
+  while(left)
+  {
+    ssize_t n = write(telemetry_fd, data, left);
+    if(n == -1 && errno == EINTR) continue;
+    if(n <= 0)
+    {
+      // nowhere to put them, stop collecting rather than stall every game
+      telemetry_len = 0;
+      telemetry_close();
+      return;
+    }
+    telemetry_size += n;
+    data += n;
+    left -= n;
+  }
+  telemetry_len = 0;
+
+  if(telemetry_size >= TELEMETRY_ROTATE) telemetry_rotate();
+}
+
+void telemetry_close()
+{
+  telemetry_flush();
+  if(telemetry_fd != -1) close(telemetry_fd);
+  free(telemetry_buf);
+  telemetry_fd = -1;
+  telemetry_buf = NULL;
+  telemetry_len = 0;
 }
 
 void nc_print_board(WINDOW * win, int curx, int cury)
 {
-	for(int r = 0; r < gboard.rows; r++)
+	int height, width;
+	getmaxyx(win, height, width);
+	if(minimap_drawn)
+	{
+		werase(win);
+		minimap_drawn = false;
+	}
+
+	// as much of the board as fits, scrolled just far enough to show the cursor
+	uint64_t rows = (uint64_t)height < gboard.rows ? (uint64_t)height : gboard.rows;
+	if(gboard.topology == TOPOLOGY_HEX && rows + 1 > (uint64_t)width) rows = width - 1;
+	uint64_t indent = gboard.topology == TOPOLOGY_HEX ? rows - 1 : 0;
+	uint64_t columns = (uint64_t)width > indent + 2 ? (width - indent) / 2 : 1;
+	if(columns > gboard.columns) columns = gboard.columns;
+
+	if((uint64_t)curx < view_row) view_row = curx;
+	else if((uint64_t)curx >= view_row + rows) view_row = curx - rows + 1;
+	if((uint64_t)cury < view_col) view_col = cury;
+	else if((uint64_t)cury >= view_col + columns) view_col = cury - columns + 1;
+
+	for(uint64_t r = view_row; r < view_row + rows; r++)
 	{
-		for(int c = 0; c < gboard.columns; c++)
+		// hex rows are drawn half a box further right than the one above
+		if(gboard.topology == TOPOLOGY_HEX) wmove(win, r - view_row, r - view_row);
+		else wmove(win, r - view_row, 0);
+
+		for(uint64_t c = view_col; c < view_col + columns; c++)
 		{
 
 			if(r == curx && c == cury) wattron(win, A_REVERSE);
@@ -408,6 +1673,10 @@ void nc_print_board(WINDOW * win, int curx, int cury)
           wattron(win, COLOR_PAIR(FLAG_COLOR));
           wprintw(win,"F ");
 
+        }
+				else if(game_result == GAME_LOST && loc->box_type == BOX_TYPE_MINE) {
+          wattroff(win, COLOR_PAIR(REVEALED_COLOR));
+          wprintw(win, "* ");
         }
 				else {
           wattroff(win, COLOR_PAIR(REVEALED_COLOR));
@@ -427,63 +1696,355 @@ void nc_print_board(WINDOW * win, int curx, int cury)
 
 
 
-void movement_handler()
+/**
+ * The board shrunk to fit the window: one character per tile of the
+ * finest region tree level that fits, so drawing it costs the same on a
+ * billion box board as on an easy one. '#' is a tile nobody has touched,
+ * '.' one with nothing left hidden and '+' anything in between; tiles
+ * with flags are in the flag color and the cursor's tile is highlighted.
+ */
+void nc_print_minimap(WINDOW * win, int curx, int cury)
+{
+	const region_tree * t = &gboard.regions;
+	int height, width;
+	getmaxyx(win, height, width);
+
+	int l = 0;
+	while(l < t->num_levels - 1 && (t->rows[l] > (uint64_t)height || t->columns[l] > (uint64_t)width)) l++;
+	int shift = REGION_BASE_SHIFT + l;
+
+	werase(win);
+	minimap_drawn = true;
+	for(uint64_t tr = 0; tr < t->rows[l] && tr < (uint64_t)height; tr++)
+	{
+		wmove(win, tr, 0);
+		for(uint64_t tc = 0; tc < t->columns[l] && tc < (uint64_t)width; tc++)
+		{
+			const region_tile * tile = &t->tiles[l][tr * t->columns[l] + tc];
+			uint64_t top, left, bottom, right;
+			region_bounds(l, tr, tc, &top, &left, &bottom, &right);
+			uint64_t known = tile->revealed + tile->flagged;
+
+			if((uint64_t)curx >> shift == tr && (uint64_t)cury >> shift == tc) wattron(win, A_REVERSE);
+			if(tile->flagged) wattron(win, COLOR_PAIR(FLAG_COLOR));
+			waddch(win, known == 0 ? '#' : known == (bottom - top) * (right - left) ? '.' : '+');
+			wattroff(win, COLOR_PAIR(FLAG_COLOR));
+			wattroff(win, A_REVERSE);
+		}
+	}
+	wrefresh(win);
+}
+
+
+/**
+ * Applies one key to the cursor / board. Returns true if anything the
+ * player can see changed and the board needs to be redrawn.
+ */
+bool handle_key(int ch, int * currow, int * curcol)
 {
+	int nrow = *currow, ncol = *curcol;
+	switch(ch)
+	{
+		case 'q':
+			quit_game(0);
+		case KEY_UP:
+			nrow--;
+			break;
+		case KEY_DOWN:
+			nrow++;
+			break;
+		case KEY_LEFT:
+			ncol--;
+			break;
+		case KEY_RIGHT:
+			ncol++;
+			break;
+		case 'F':
+		case 'f':
+			if(set_flag(*currow, *curcol)) game_flags++;
+			hint_reset();
+			draw_clock();
+			if(game_result == GAME_PLAYING && checkwin()) wingame();
+			return true;
+		case 'a':
+			reveal_location(*currow, *curcol);
+			game_clicks++;
+			hint_reset();
+			if(game_result == GAME_PLAYING && checkwin()) wingame();
+			return true;
+		case 'c':
+			chord_location(*currow, *curcol);
+			game_clicks++;
+			hint_reset();
+			if(game_result == GAME_PLAYING && checkwin()) wingame();
+			return true;
+		case 'n':
+			game_result = GAME_RESTART;
+			return true;
+		case 'm':
+			show_minimap = !show_minimap;
+			return true;
+		case 'h':
+			if(hint_state != HINT_FOUND) return false;
+			*currow = hint_box / gboard.stride - 1;
+			*curcol = hint_box % gboard.stride - 1;
+			return true;
+		default:
+			return false;
+	}
+
+	if(ncol < 0 || ncol > gboard.columns -1 || nrow < 0 || nrow > gboard.rows -1)
+		return false;
+
+	*currow = nrow;
+	*curcol = ncol;
+	return true;
+}
+
+/**
+ * Reads every key that is already waiting without blocking and applies
+ * them all, so auto-repeat or pasted input is consumed as one batch
+ * instead of costing one render per key.
+ */
+bool drain_input(int * currow, int * curcol)
+{
+	bool dirty = false;
 	int ch;
+
+	// anything typed after the game ended is for the next one
+	wtimeout(gamewindow, 0);
+	while(game_result == GAME_PLAYING && (ch = wgetch(gamewindow)) != ERR)
+		dirty |= handle_key(ch, currow, curcol);
+	return dirty;
+}
+
+long long now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/**
+ * The interactive loop. It sleeps in poll() on the terminal and a once a
+ * second timerfd for the clock, so an idle game costs nothing and a key
+ * wakes it straight away. Frames are still capped at FRAME_INTERVAL_MS;
+ * a frame that isn't due yet just becomes the poll timeout. Spare time
+ * goes to hint_work() in small slices until it runs out of things to do.
+ *
+ * Returns once the game is over, true if the player wants another one.
+ * The clock window and timer are made on the first call and kept; with
+ * CMTEST_NO_CLOCK set in the environment there is no timer and the clock
+ * is only redrawn along with the moves that change it. A
+ * quitting signal arriving on signal_fd ends the program from here.
+ */
+bool movement_handler()
+{
+	static int timer_fd = -1;
 	int currow = 0, curcol = 0;
+	bool dirty = false;
+	werase(gamewindow);
 	nc_print_board(gamewindow, 0, 0);
+	long long last_frame = now_ms();
+
+	game_started = last_frame;
+	// wide enough for the end of game message, init_window made sure of 3
+	if(!clockwindow) clockwindow = newwin(1, COLS - 3, 1, 3);
+	draw_clock();
+
+	struct itimerspec tick = { .it_interval = { 1, 0 }, .it_value = { 1, 0 } };
+	if(timer_fd == -1 && !getenv("CMTEST_NO_CLOCK")) timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	// restart the second hand along with the game
+	if(timer_fd != -1) timerfd_settime(timer_fd, 0, &tick, NULL);
+
+	// poll() skips any of these that is -1
+	struct pollfd fds[3] = {
+		{ .fd = STDIN_FILENO, .events = POLLIN },
+		{ .fd = timer_fd, .events = POLLIN },
+		{ .fd = signal_fd, .events = POLLIN }
+	};
+
+	while(game_result == GAME_PLAYING)
+	{
+		int timeout = -1;
+		if(dirty)
+		{
+			long long wait = last_frame + FRAME_INTERVAL_MS - now_ms();
+			timeout = wait > 0 ? (int)wait : 0;
+		}
+		else if(hint_state == HINT_SEARCHING) timeout = 0;
+		// about to sleep until the player does something, get the log onto disk
+		else if(telemetry_len) telemetry_flush();
+
+		int ready = poll(fds, 3, timeout);
+		if(ready == -1 && errno != EINTR)
+		{
+			cleanup();
+			printf("poll failed: %s\n", strerror(errno));
+			exit(1);
+		}
 
-	while((ch = wgetch(gamewindow)))
+		if(ready > 0 && fds[2].revents & POLLIN)
+			quit_on_signal();
+
+		if(ready > 0 && fds[0].revents & POLLIN)
+			dirty |= drain_input(&currow, &curcol);
+
+		if(ready > 0 && fds[1].revents & POLLIN)
+		{
+			uint64_t expirations;
+			if(read(timer_fd, &expirations, sizeof(expirations)) > 0) draw_clock();
+		}
+
+		if(dirty && now_ms() >= last_frame + FRAME_INTERVAL_MS)
+		{
+			wmove(gamewindow, 0, 0);
+			if(show_minimap) nc_print_minimap(gamewindow, currow, curcol);
+			else nc_print_board(gamewindow, currow, curcol);
+			last_frame = now_ms();
+			dirty = false;
+		}
+		else if(ready == 0 && !dirty) hint_work();
+	}
+
+	game_finished = now_ms();
+	telemetry_game(game_result == GAME_WON ? CMT_RESULT_WON :
+	               game_result == GAME_LOST ? CMT_RESULT_LOST : CMT_RESULT_ABANDONED);
+	if(game_result == GAME_RESTART) return true;
+
+	// the prompt below waits on the player too
+	telemetry_flush();
+
+	// leave the last board up until the player picks
+	wmove(gamewindow, 0, 0);
+	nc_print_board(gamewindow, currow, curcol);
+	draw_clock();
+	wtimeout(gamewindow, 0);
+	struct pollfd wait[2] = { fds[0], fds[2] };
+	for(;;)
 	{
-		int cccpy = curcol, crcpy = currow;
-		switch(ch)
+		if(poll(wait, 2, -1) == -1 && errno != EINTR) return false;
+		if(wait[1].revents & POLLIN) quit_on_signal();
+		// the terminal went away
+		if(wait[0].revents & (POLLHUP | POLLERR)) return false;
+
+		int ch;
+		while((ch = wgetch(gamewindow)) != ERR)
 		{
-			case 'q':
-				cleanup();
-				exit(0);
-			case KEY_UP:
-				currow--;
-				break;
-			case KEY_DOWN:
-				currow++;
-				break;
-			case KEY_LEFT:
-				curcol--;
-				break;
-			case KEY_RIGHT:
-				curcol++;
-				break;
-			case 'F':
-			case 'f':{
-				set_flag(currow, curcol);
-				break;
-			}
-      case 'a':
-        reveal_location(currow, curcol);
-        break;
-			default:
-				continue;
+			if(ch == 'n') return true;
+			if(ch == 'q') return false;
 		}
-		
-		if(curcol < 0 || curcol > gboard.columns -1 || currow < 0 || currow > gboard.rows -1)
-    {
-      curcol = cccpy;
-      currow = crcpy;
-      continue;
-    }
+	}
+}
+
+void draw_clock()
+{
+	long long secs = ((game_result == GAME_PLAYING ? now_ms() : game_finished) - game_started) / 1000;
+	werase(clockwindow);
+	wprintw(clockwindow, "%02lld:%02lld  flags %" PRIu64 "/%" PRIu64 "%s", secs / 60, secs % 60,
+	        gboard.flags_placed, gboard.number_mines,
+	        game_result == GAME_WON ? "  Congrats you win :)  n: new game, q: quit" :
+	        game_result == GAME_LOST ? "  Sorry, you lost :(  n: new game, q: quit" :
+	        hint_state == HINT_FOUND ? "  hint: h" : "");
+	wrefresh(clockwindow);
+}
+
+// nothing is revealed on a new board, so there's nothing to look for yet
+void hint_clear()
+{
+	hint_state = HINT_NONE;
+	hint_scan = hint_end = 0;
+	hint_lo = UINT64_MAX;
+	hint_hi = 0;
+}
+
+// notes that a move changed the boxes in [lo, hi]
+void hint_touch(uint64_t lo, uint64_t hi)
+{
+	if(lo < hint_lo) hint_lo = lo;
+	if(hi > hint_hi) hint_hi = hi;
+}
+
+/**
+ * A move changed the board. Only boxes next to one it changed can have
+ * become, or stopped being, a hint, and everything else was already
+ * looked at, so the search picks up again over the rows around the
+ * change plus whatever the last search hadn't got to yet.
+ */
+void hint_reset()
+{
+	if(hint_lo > hint_hi) return;
+
+	uint64_t end = gboard.stride * (gboard.rows + 2);
+	uint64_t lo = hint_lo > gboard.stride + 1 ? hint_lo - gboard.stride - 1 : 0;
+	uint64_t hi = hint_hi + gboard.stride + 2;
+	if(gboard.topology == TOPOLOGY_TORUS)
+	{
+		// neighbors wrap round to the far edge of the board
+		if(hint_lo < 2 * gboard.stride || hint_hi >= gboard.rows * gboard.stride) lo = 0, hi = end;
+		else lo -= gboard.stride, hi += gboard.stride;
+	}
+	if(hi > end) hi = end;
+
+	if(hint_state != HINT_NONE)
+	{
+		if(hint_scan < lo) lo = hint_scan;
+		if(hint_end > hi) hi = hint_end;
+	}
+	hint_state = HINT_SEARCHING;
+	hint_scan = lo;
+	hint_end = hi;
+	hint_lo = UINT64_MAX;
+	hint_hi = 0;
+}
+
+/**
+ * Looks for a box that is provably safe: a hidden neighbor of a number
+ * that already has that many flags around it. Scans HINT_SLICE boxes per
+ * call so input never waits more than a slice.
+ */
+void hint_work()
+{
+	uint64_t end = hint_end;
+	uint64_t stop = hint_scan + HINT_SLICE < end ? hint_scan + HINT_SLICE : end;
+
+	for(; hint_scan < stop; hint_scan++)
+	{
+		gbox * loc = &gboard.board[hint_scan];
+		if(!loc->is_revealed || loc->box_type == BOX_TYPE_SENTINEL || !loc->num_mines_around) continue;
+
+		unsigned int flags = 0;
+		uint64_t hidden = UINT64_MAX;
+		for(int i = 0; i < gboard.num_neighbors; i++)
+		{
+			uint64_t n = hint_scan + gboard.neighbors[i];
+			if(gboard.board[n].box_type == BOX_TYPE_SENTINEL && gboard.topology == TOPOLOGY_TORUS)
+				n = torus_wrap(n);
+			if(gboard.board[n].is_flagged) flags++;
+			else if(!gboard.board[n].is_revealed) hidden = n;
+		}
+
+		if(flags == loc->num_mines_around && hidden != UINT64_MAX)
+		{
+			hint_box = hidden;
+			hint_state = HINT_FOUND;
+			draw_clock();
+			return;
+		}
+	}
 
-		clear();
-		wmove(gamewindow, 0, 0);
-		nc_print_board(gamewindow, currow, curcol);
-    if(checkwin()) wingame();
-	}	
+	if(hint_scan == end) hint_state = HINT_NONE;
 }
 
-void set_flag(int x, int y)
+// false if there was nothing to toggle
+bool set_flag(uint64_t x, uint64_t y)
 {
 	gbox * loc = &GET_LOC(x,y);
 	// loc->is_flagged = !loc->is_flagged;
   // return;
+  // nothing left to mark on a revealed box
+  if(loc->is_revealed) return false;
+  hint_touch(loc - gboard.board, loc - gboard.board);
   if(!loc->is_flagged)
   {
     loc->is_flagged = true; 
@@ -495,26 +2056,396 @@ void set_flag(int x, int y)
     gboard.flags_placed--;
     if(loc->box_type == BOX_TYPE_MINE) gboard.num_mines_flagged--;
   }
+  region_add(loc - gboard.board, 0, loc->is_flagged ? 1 : -1);
+
+  if(observer)
+  {
+    observe_box(loc - gboard.board, loc->is_flagged ? CMO_CELL_FLAG : loc->is_revealed ? loc->num_mines_around : CMO_CELL_HIDDEN);
+    observe_counters(CMO_GAME_PLAYING);
+  }
+  return true;
 }
 
 
-void reveal_location(int x, int y)
+void reveal_location(uint64_t x, uint64_t y)
 {
-  // probably not necessary but better safe than sorry
-  if(x > gboard.columns || x < 0 || y > gboard.rows || y < 0) return;
-
   gbox * loc = &GET_LOC(x,y);
 
   if(loc->is_flagged) return;
 
   else if(loc->is_revealed) return;
   
-  else if(loc->box_type == BOX_TYPE_MINE) gameover();
+  else if(loc->box_type == BOX_TYPE_MINE)
+  {
+    gameover(loc - gboard.board);
+    return;
+  }
   
-  else{
-    loc->is_revealed = true;
+  else flood_reveal(loc - gboard.board);
+
+  observe_counters(CMO_GAME_PLAYING);
+}
+
+/**
+ * Reveals idx and, through every box with no mines around it, everything
+ * connected to it. Boxes are marked revealed as they're pushed, so each
+ * one goes on the stack once and the stack never outgrows the opening.
+ */
+void flood_reveal(uint64_t idx)
+{
+  uint64_t top = 0, lo = idx, hi = idx;
+
+  gboard.board[idx].is_revealed = true;
+  if(!flood_stack_cap)
+  {
+    flood_stack_cap = 1024;
+    flood_stack = (uint64_t *)malloc(sizeof(uint64_t) * flood_stack_cap);
+  }
+  if(!flood_stack) goto nomem;
+  flood_stack[top++] = idx;
+
+  while(top)
+  {
+    // the spectator ring only has room for one writer
+    if(top >= flood_parallel_min && flood_threads != 1 && !observer && flood_parallel(top)) break;
+
+    idx = flood_stack[--top];
+    if(idx < lo) lo = idx;
+    if(idx > hi) hi = idx;
     gboard.num_places_revealed++;
+    region_add(idx, 1, 0);
+    if(observer) observe_box(idx, gboard.board[idx].num_mines_around);
+    if(gboard.board[idx].num_mines_around) continue;
+
+    if(flood_stack_cap - top < 8)
+    {
+      uint64_t * grown = (uint64_t *)realloc(flood_stack, sizeof(uint64_t) * flood_stack_cap * 2);
+      if(!grown) goto nomem;
+      flood_stack = grown;
+      flood_stack_cap *= 2;
+    }
+
+    for(int i = 0; i < gboard.num_neighbors; i++)
+    {
+      uint64_t n = idx + gboard.neighbors[i];
+      gbox * nloc = &gboard.board[n];
+      if(nloc->is_revealed) continue;
+      // only ever true on a torus, everywhere else the ring is revealed
+      if(nloc->box_type == BOX_TYPE_SENTINEL)
+      {
+        n = torus_wrap(n);
+        nloc = &gboard.board[n];
+        if(nloc->is_revealed) continue;
+      }
+      if(nloc->is_flagged) continue;
+
+      nloc->is_revealed = true;
+      flood_stack[top++] = n;
+    }
+  }
+  hint_touch(lo, hi);
+  return;
+
+nomem:
+  cleanup();
+  printf("Out of memory revealing the board\n");
+  exit(1);
+}
+
+static bool flood_push(flood_worker * w, uint64_t idx)
+{
+  if(w->top == w->cap)
+  {
+    uint64_t cap = w->cap ? w->cap * 2 : 1024;
+    uint64_t * grown = (uint64_t *)realloc(w->stack, sizeof(uint64_t) * cap);
+    if(!grown) return false;
+    w->stack = grown;
+    w->cap = cap;
+  }
+  w->stack[w->top++] = idx;
+  return true;
+}
+
+static void flood_count_tile(flood_worker * w, uint64_t idx)
+{
+  uint64_t r = idx / gboard.stride - 1, c = idx % gboard.stride - 1;
+  uint64_t tile = (r >> REGION_BASE_SHIFT) * gboard.regions.columns[0] + (c >> REGION_BASE_SHIFT);
+  if(tile != w->tile)
+  {
+    if(w->tile_revealed)
+      __atomic_fetch_add(&gboard.regions.tiles[0][w->tile].revealed, w->tile_revealed, __ATOMIC_RELAXED);
+    w->tile = tile;
+    w->tile_revealed = 0;
+  }
+  w->tile_revealed++;
+}
+
+// gives the older half of w's stack to whoever is waiting for work
+static void flood_share(flood_worker * w)
+{
+  uint64_t len = w->top / 2;
+  flood_chunk * chunk = (flood_chunk *)malloc(sizeof(flood_chunk) + sizeof(uint64_t) * len);
+  if(!chunk) return;
+
+  chunk->len = len;
+  memcpy(chunk->boxes, w->stack, sizeof(uint64_t) * len);
+  memmove(w->stack, w->stack + len, sizeof(uint64_t) * (w->top - len));
+  w->top -= len;
+
+  pthread_mutex_lock(&flood_lock);
+  chunk->next = flood_shared;
+  flood_shared = chunk;
+  pthread_cond_signal(&flood_wake);
+  pthread_mutex_unlock(&flood_lock);
+}
+
+/**
+ * Blocks until there is shared work for w, false once the flood is
+ * over: every running worker is in here and nothing is left to share.
+ */
+static bool flood_take(flood_worker * w)
+{
+  pthread_mutex_lock(&flood_lock);
+  while(!flood_shared && !flood_done)
+  {
+    if(++flood_idle == flood_running)
+    {
+      // nobody is left holding work, so none can be coming
+      flood_done = true;
+      pthread_cond_broadcast(&flood_wake);
+      break;
+    }
+    atomic_fetch_add_explicit(&flood_hungry, 1, memory_order_relaxed);
+    pthread_cond_wait(&flood_wake, &flood_lock);
+    atomic_fetch_sub_explicit(&flood_hungry, 1, memory_order_relaxed);
+    flood_idle--;
+  }
+
+  flood_chunk * chunk = flood_shared;
+  if(chunk && !flood_done) flood_shared = chunk->next;
+  else chunk = NULL;
+  pthread_mutex_unlock(&flood_lock);
+  if(!chunk) return false;
+
+  for(uint64_t i = 0; i < chunk->len; i++)
+  {
+    if(!flood_push(w, chunk->boxes[i]))
+    {
+      atomic_store(&flood_failed, true);
+      break;
+    }
+  }
+  free(chunk);
+  return true;
+}
+
+static void * flood_worker_main(void * arg)
+{
+  flood_worker * w = (flood_worker *)arg;
+  uint64_t since_check = 0;
+
+  do
+  {
+    while(w->top)
+    {
+      uint64_t idx = w->stack[--w->top];
+      w->revealed++;
+      if(idx < w->lo) w->lo = idx;
+      if(idx > w->hi) w->hi = idx;
+      flood_count_tile(w, idx);
+      if(gboard.board[idx].num_mines_around) continue;
+
+      if(++since_check == FLOOD_CHECK_EVERY)
+      {
+        since_check = 0;
+        if(atomic_load_explicit(&flood_hungry, memory_order_relaxed) && w->top >= 64) flood_share(w);
+      }
+
+      for(int i = 0; i < gboard.num_neighbors; i++)
+      {
+        uint64_t n = idx + gboard.neighbors[i];
+        gbox * nloc = &gboard.board[n];
+        if(__atomic_load_n(&nloc->is_revealed, __ATOMIC_RELAXED)) continue;
+        if(nloc->box_type == BOX_TYPE_SENTINEL)
+        {
+          n = torus_wrap(n);
+          nloc = &gboard.board[n];
+          if(__atomic_load_n(&nloc->is_revealed, __ATOMIC_RELAXED)) continue;
+        }
+        if(nloc->is_flagged) continue;
+
+        // whoever flips it from hidden owns it, everyone else moves on
+        bool hidden = false;
+        if(!__atomic_compare_exchange_n(&nloc->is_revealed, &hidden, true, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+          continue;
+        if(!flood_push(w, n))
+        {
+          // the game is over either way, stop adding work
+          atomic_store(&flood_failed, true);
+          w->top = 0;
+          break;
+        }
+      }
+    }
+  } while(flood_take(w));
+
+  if(w->tile_revealed)
+    __atomic_fetch_add(&gboard.regions.tiles[0][w->tile].revealed, w->tile_revealed, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+/**
+ * Finishes a flood whose frontier, flood_stack[0, top), has grown big
+ * enough to be worth splitting across every core. The frontier is cut
+ * into one chunk per worker and each floods on its own stack from
+ * there, taking boxes by flipping is_revealed with a compare and swap so
+ * no box is counted twice. A worker that runs dry waits for a busy one
+ * to notice and hand over half of its stack. Revealed counts stay per
+ * worker until the end and the region tree only sees leaf tiles, so
+ * neither is a shared cache line per box. The calling thread is worker
+ * 0. Returns false, leaving the stack alone, on a single core.
+ */
+bool flood_parallel(uint64_t top)
+{
+  if(!flood_threads)
+  {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    flood_threads = cpus < 1 ? 1 : cpus > FLOOD_MAX_THREADS ? FLOOD_MAX_THREADS : cpus;
+  }
+  if(flood_threads < 2) return false;
+
+  int n = flood_threads;
+  flood_shared = NULL;
+  for(int t = n - 1; t >= 0; t--)
+  {
+    uint64_t from = top * t / n, len = top * (t + 1) / n - from;
+    flood_chunk * chunk = (flood_chunk *)malloc(sizeof(flood_chunk) + sizeof(uint64_t) * len);
+    if(!chunk)
+    {
+      while(flood_shared)
+      {
+        chunk = flood_shared->next;
+        free(flood_shared);
+        flood_shared = chunk;
+      }
+      return false;
+    }
+    chunk->len = len;
+    memcpy(chunk->boxes, flood_stack + from, sizeof(uint64_t) * len);
+    chunk->next = flood_shared;
+    flood_shared = chunk;
+  }
+
+  flood_worker workers[FLOOD_MAX_THREADS];
+  memset(workers, 0, sizeof(workers));
+  for(int t = 0; t < n; t++) workers[t].lo = UINT64_MAX;
+  flood_running = 1;
+  flood_idle = 0;
+  flood_done = false;
+  atomic_store(&flood_hungry, 0);
+  atomic_store(&flood_failed, false);
+
+  // a thread that doesn't start just leaves its chunk to the others
+  int started = 1;
+  for(; started < n; started++)
+  {
+    pthread_mutex_lock(&flood_lock);
+    flood_running++;
+    pthread_mutex_unlock(&flood_lock);
+    if(pthread_create(&workers[started].thread, NULL, flood_worker_main, &workers[started]) != 0)
+    {
+      pthread_mutex_lock(&flood_lock);
+      flood_running--;
+      pthread_mutex_unlock(&flood_lock);
+      break;
+    }
+  }
+  flood_worker_main(&workers[0]);
+
+  uint64_t revealed = 0;
+  for(int t = 0; t < started; t++)
+  {
+    if(t) pthread_join(workers[t].thread, NULL);
+    revealed += workers[t].revealed;
+    if(workers[t].revealed) hint_touch(workers[t].lo, workers[t].hi);
+    free(workers[t].stack);
   }
+  gboard.num_places_revealed += revealed;
+  region_rebuild();
+
+  if(atomic_load(&flood_failed))
+  {
+    cleanup();
+    printf("Out of memory revealing the board\n");
+    exit(1);
+  }
+  return true;
+}
+
+/**
+ * Clears the first box with no mines around it, the way pressing 'a'
+ * there would, and reports how long the opening took. threads is 1 for
+ * the plain flood and 0 for every core. A low density board has one
+ * opening covering most of it, e.g. `custom 8000 8000 0.5% reveal-bench`.
+ */
+int reveal_bench(int threads)
+{
+  flood_threads = threads;
+
+  uint64_t idx = 0, end = gboard.stride * (gboard.rows + 2);
+  while(idx < end && (gboard.board[idx].box_type != BOX_TYPE_EMPTY || gboard.board[idx].num_mines_around)) idx++;
+  if(idx == end)
+  {
+    printf("No box on this board is clear of mines all around\n");
+    return -1;
+  }
+
+  struct timespec start, stop;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  reveal_location(idx / gboard.stride - 1, idx % gboard.stride - 1);
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+
+  double ms = (stop.tv_sec - start.tv_sec) * 1e3 + (stop.tv_nsec - start.tv_nsec) / 1e6;
+  printf("%" PRIu64 " of %" PRIu64 " boxes revealed in %.1f ms, %.1f Mboxes/s, %d thread%s\n",
+         gboard.num_places_revealed, gboard.size - gboard.number_mines, ms,
+         gboard.num_places_revealed / ms / 1e3, flood_threads, flood_threads == 1 ? "" : "s");
+  return 0;
+}
+
+/**
+ * Clicking a number that already has that many flags around it reveals
+ * all of its other neighbors, and loses if one of the flags was wrong.
+ */
+void chord_location(uint64_t x, uint64_t y)
+{
+  gbox * loc = &GET_LOC(x,y);
+  if(!loc->is_revealed) return;
+
+  uint64_t idx = loc - gboard.board;
+  uint64_t around[8];
+  unsigned int flags = 0;
+
+  for(int i = 0; i < gboard.num_neighbors; i++)
+  {
+    around[i] = idx + gboard.neighbors[i];
+    if(gboard.board[around[i]].box_type == BOX_TYPE_SENTINEL && gboard.topology == TOPOLOGY_TORUS)
+      around[i] = torus_wrap(around[i]);
+    flags += gboard.board[around[i]].is_flagged;
+  }
+  if(flags != loc->num_mines_around) return;
+
+  for(int i = 0; i < gboard.num_neighbors; i++)
+  {
+    gbox * nloc = &gboard.board[around[i]];
+    if(nloc->is_revealed || nloc->is_flagged) continue;
+    if(nloc->box_type == BOX_TYPE_MINE)
+    {
+      gameover(around[i]);
+      return;
+    }
+    flood_reveal(around[i]);
+  }
+  observe_counters(CMO_GAME_PLAYING);
 }
 
 
@@ -527,7 +2458,6 @@ bool checkwin()
 
 void wingame()
 {
-  cleanup();
-  printf("\n\nCongrats you win :)\n");
-  exit(0);
+  game_result = GAME_WON;
+  observe_gameover(CMO_GAME_WON);
 }
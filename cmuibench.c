@@ -0,0 +1,270 @@
+// This file is licensed under GPLv3 <https://www.gnu.org/licenses/>
+// gcc cmuibench.c -o cmuibench -lutil -lcurses
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <pty.h>
+#include <sys/wait.h>
+#include <curses.h>
+#include <term.h>
+
+/**
+ * End to end UI benchmark.
+ *
+ * Runs the curses game under a pseudo-terminal and types at it the way
+ * a player would, then records for every key how many bytes the game
+ * wrote to the terminal and how long it took from the key being sent
+ * to the last byte of the resulting frame. The screen counts as settled
+ * once nothing has arrived for SETTLE_MS. The game is started with
+ * CMTEST_NO_CLOCK set so only frames caused by keys are measured.
+ *
+ *   cmuibench [-b] [-n repeats] [-s script] [-- binary args...]
+ *
+ * The default is ./cmtest medium with a script that sweeps the cursor
+ * around the board and toggles a few flags, the same kind of movement
+ * loop as cursestest.c. A script file is whitespace separated words:
+ * up, down, left, right, or any single character to type as is.
+ *
+ * With -b the whole key stream is written in one go and only the time
+ * until the screen settles is measured, which is what pasted input or
+ * key repeat looks like to the game.
+ */
+
+#define SETTLE_MS       40
+#define STARTUP_MS      2000
+#define TERM_ROWS       60
+#define TERM_COLS       200
+
+typedef struct key_result
+{
+  size_t bytes;
+  double latency_ms;
+} key_result;
+
+// GLOBALS
+pid_t child = -1;
+int master_fd = -1;
+char ** keys;
+size_t num_keys;
+size_t keys_cap;
+
+static void add_key(const char * word);
+static void load_script(const char * path);
+static void default_script(int repeats);
+static size_t settle(int timeout_ms, double * last_byte);
+static double now_ms();
+static int compare_double(const void * a, const void * b);
+
+
+int main(int argc, char ** argv)
+{
+  bool burst = false;
+  int repeats = 4;
+  const char * script = NULL;
+  int opt;
+
+  while((opt = getopt(argc, argv, "bn:s:")) != -1)
+  {
+    switch(opt)
+    {
+      case 'b': burst = true; break;
+      case 'n': repeats = atoi(optarg); break;
+      case 's': script = optarg; break;
+      default:
+        printf("usage: %s [-b] [-n repeats] [-s script] [-- binary args...]\n", argv[0]);
+        exit(1);
+    }
+  }
+
+  char * default_cmd[] = { "./cmtest", "medium", NULL };
+  char ** cmd = optind < argc ? argv + optind : default_cmd;
+
+  // key sequences depend on the terminal, so ask terminfo like the game will
+  setenv("TERM", "xterm", 1);
+  // the game's once a second clock redraw would land in some keys' frames
+  setenv("CMTEST_NO_CLOCK", "1", 1);
+  int err;
+  if(setupterm("xterm", STDOUT_FILENO, &err) != OK)
+  {
+    printf("No terminfo entry for xterm\n");
+    exit(1);
+  }
+
+  if(script) load_script(script);
+  else default_script(repeats);
+
+  struct winsize ws = { .ws_row = TERM_ROWS, .ws_col = TERM_COLS };
+  child = forkpty(&master_fd, NULL, NULL, &ws);
+  if(child == -1)
+  {
+    printf("forkpty failed: %s\n", strerror(errno));
+    exit(1);
+  }
+  if(child == 0)
+  {
+    execv(cmd[0], cmd);
+    _exit(127);
+  }
+
+  // wait for the first frame, then for it to finish
+  double last_byte;
+  struct pollfd first = { .fd = master_fd, .events = POLLIN };
+  poll(&first, 1, STARTUP_MS);
+  size_t startup = settle(SETTLE_MS, &last_byte);
+  printf("startup: %zu bytes\n", startup);
+
+  key_result * results = calloc(num_keys, sizeof(key_result));
+  size_t total_bytes = 0;
+
+  if(burst)
+  {
+    double start = now_ms();
+    for(size_t i = 0; i < num_keys; i++)
+      if(write(master_fd, keys[i], strlen(keys[i])) == -1) break;
+    total_bytes = settle(SETTLE_MS, &last_byte);
+    printf("burst: %zu keys, %zu bytes, settled after %.2f ms\n",
+           num_keys, total_bytes, last_byte > 0 ? last_byte - start : 0.0);
+  }
+  else
+  {
+    size_t quiet = 0, frames = 0, max_bytes = 0;
+    double * latencies = calloc(num_keys, sizeof(double));
+
+    for(size_t i = 0; i < num_keys; i++)
+    {
+      double start = now_ms();
+      if(write(master_fd, keys[i], strlen(keys[i])) == -1) break;
+      results[i].bytes = settle(SETTLE_MS, &last_byte);
+      if(waitpid(child, NULL, WNOHANG) == child)
+      {
+        child = -1;
+        printf("game exited after key %zu\n", i);
+        break;
+      }
+
+      total_bytes += results[i].bytes;
+      if(!results[i].bytes)
+      {
+        quiet++;
+        continue;
+      }
+      results[i].latency_ms = last_byte - start;
+      latencies[frames++] = results[i].latency_ms;
+      if(results[i].bytes > max_bytes) max_bytes = results[i].bytes;
+    }
+
+    qsort(latencies, frames, sizeof(double), compare_double);
+    printf("keys: %zu, %zu drew nothing\n", num_keys, quiet);
+    if(frames)
+    {
+      printf("bytes/frame: mean %.1f, max %zu, total %zu\n",
+             (double)total_bytes / frames, max_bytes, total_bytes);
+      printf("latency ms: p50 %.2f, p90 %.2f, p99 %.2f, max %.2f\n",
+             latencies[frames / 2], latencies[frames * 9 / 10],
+             latencies[frames * 99 / 100], latencies[frames - 1]);
+    }
+    free(latencies);
+  }
+
+  if(child != -1)
+  {
+    if(write(master_fd, "q", 1) == -1 || settle(SETTLE_MS, &last_byte) == 0)
+      kill(child, SIGTERM);
+    waitpid(child, NULL, 0);
+  }
+  free(results);
+  return 0;
+}
+
+
+void add_key(const char * word)
+{
+  const char * seq = word;
+  if(strcmp(word, "up") == 0) seq = tigetstr("kcuu1");
+  else if(strcmp(word, "down") == 0) seq = tigetstr("kcud1");
+  else if(strcmp(word, "left") == 0) seq = tigetstr("kcub1");
+  else if(strcmp(word, "right") == 0) seq = tigetstr("kcuf1");
+  if(!seq || seq == (char *)-1)
+  {
+    printf("Unknown key %s\n", word);
+    exit(1);
+  }
+
+  if(num_keys == keys_cap)
+  {
+    keys_cap = keys_cap ? keys_cap * 2 : 64;
+    keys = realloc(keys, sizeof(char *) * keys_cap);
+  }
+  keys[num_keys++] = strdup(seq);
+}
+
+void load_script(const char * path)
+{
+  FILE * f = fopen(path, "r");
+  if(!f)
+  {
+    printf("Failed to open %s\n", path);
+    exit(1);
+  }
+
+  char word[64];
+  while(fscanf(f, "%63s", word) == 1) add_key(word);
+  fclose(f);
+}
+
+// sweep the cursor over a medium board and back, flagging as we go
+void default_script(int repeats)
+{
+  for(int n = 0; n < repeats; n++)
+  {
+    for(int row = 0; row < 15; row++)
+    {
+      for(int col = 0; col < 15; col++) add_key(row % 2 ? "left" : "right");
+      add_key("f");
+      add_key("f");
+      add_key("down");
+    }
+    for(int row = 0; row < 15; row++) add_key("up");
+  }
+}
+
+/**
+ * Reads everything the game writes until it has been quiet for
+ * timeout_ms. Returns the byte count and the time of the last byte.
+ */
+size_t settle(int timeout_ms, double * last_byte)
+{
+  char buf[65536];
+  size_t total = 0;
+  struct pollfd pfd = { .fd = master_fd, .events = POLLIN };
+
+  *last_byte = 0;
+  while(poll(&pfd, 1, timeout_ms) > 0)
+  {
+    ssize_t n = read(master_fd, buf, sizeof(buf));
+    if(n <= 0) break;
+    total += n;
+    *last_byte = now_ms();
+  }
+  return total;
+}
+
+double now_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+int compare_double(const void * a, const void * b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
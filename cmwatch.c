@@ -0,0 +1,170 @@
+// This file is licensed under GPLv3 <https://www.gnu.org/licenses/>
+// gcc cmwatch.c -o cmwatch
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cmobserve.h"
+
+/**
+ * Spectator for a game started with `cmtest <difficulty> observe <name>`.
+ *
+ *   cmwatch <name>        follow the event ring, one line per changed box
+ *   cmwatch -b <name>     print the board plane once and exit
+ *
+ * Nothing here writes to the segment, any number of these can run
+ * against the same game.
+ */
+
+#define POLL_US   10000
+
+typedef struct counters
+{
+  uint64_t num_places_revealed;
+  uint64_t flags_placed;
+  uint64_t num_mines_flagged;
+  uint64_t game_state;
+} counters;
+
+// GLOBALS
+const cmo_header * header;
+const uint8_t * plane;
+const cmo_event * ring;
+
+static void read_counters(counters * out);
+static void print_board();
+static const char cell_chars[] = "o12345678.F*";
+
+
+int main(int argc, char ** argv)
+{
+  bool board_only = argc > 2 && strcmp(argv[1], "-b") == 0;
+  if(argc < 2 || (argc > 2 && !board_only))
+  {
+    printf("usage: %s [-b] <name>\n", argv[0]);
+    exit(1);
+  }
+
+  char name[256];
+  const char * arg = argv[argc - 1];
+  snprintf(name, sizeof(name), "%s%s", arg[0] == '/' ? "" : "/", arg);
+
+  int fd = shm_open(name, O_RDONLY, 0);
+  struct stat st;
+  if(fd == -1 || fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(cmo_header))
+  {
+    printf("No game published as %s\n", arg);
+    exit(1);
+  }
+
+  void * mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(mem == MAP_FAILED)
+  {
+    printf("Failed to map %s\n", arg);
+    exit(1);
+  }
+
+  header = mem;
+  while(__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != CMO_MAGIC) usleep(POLL_US);
+  if(header->version != CMO_VERSION)
+  {
+    printf("Unsupported segment version %u\n", header->version);
+    exit(1);
+  }
+  plane = (const uint8_t *)mem + header->plane_offset;
+  ring = (const cmo_event *)((const uint8_t *)mem + header->ring_offset);
+
+  printf("%" PRIu64 "x%" PRIu64 " board, %" PRIu64 " mines\n", header->rows, header->columns, header->number_mines);
+  if(board_only)
+  {
+    print_board();
+    return 0;
+  }
+
+  // start from the oldest event still in the ring
+  uint64_t next = atomic_load_explicit(&header->ring_head, memory_order_acquire);
+  next = next > header->ring_capacity ? next - header->ring_capacity : 0;
+  counters last = { 0 };
+
+  for(;;)
+  {
+    uint64_t head = atomic_load_explicit(&header->ring_head, memory_order_acquire);
+    if(head - next > header->ring_capacity)
+    {
+      printf("missed %" PRIu64 " events, resyncing from the board\n", head - next - header->ring_capacity);
+      next = head - header->ring_capacity;
+    }
+
+    for(; next < head; next++)
+    {
+      const cmo_event * slot = &ring[next & (header->ring_capacity - 1)];
+      uint64_t s1 = atomic_load_explicit(&slot->seq, memory_order_acquire);
+      uint64_t event = atomic_load_explicit(&slot->event, memory_order_relaxed);
+      atomic_thread_fence(memory_order_acquire);
+      uint64_t s2 = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+      if(s1 != next + 1 || s2 != s1) continue;   // overwritten while we looked
+
+      uint64_t idx = event >> 8;
+      uint8_t value = event & 0xff;
+      printf("%" PRIu64 ",%" PRIu64 " %c\n", idx / header->stride - 1, idx % header->stride - 1,
+             value < sizeof(cell_chars) - 1 ? cell_chars[value] : '?');
+    }
+
+    counters now;
+    read_counters(&now);
+    if(now.game_state == CMO_GAME_CLOSED)
+    {
+      printf("game closed\n");
+      return 0;
+    }
+    if(memcmp(&now, &last, sizeof(now)) != 0)
+    {
+      printf("revealed %" PRIu64 ", flags %" PRIu64 "\n", now.num_places_revealed, now.flags_placed);
+      last = now;
+    }
+    if(now.game_state != CMO_GAME_PLAYING)
+    {
+      print_board();
+      printf(now.game_state == CMO_GAME_WON ? "game won\n" : "game lost\n");
+      return 0;
+    }
+    fflush(stdout);
+    usleep(POLL_US);
+  }
+}
+
+void read_counters(counters * out)
+{
+  uint64_t s1, s2;
+  do
+  {
+    s1 = atomic_load_explicit(&header->seq, memory_order_acquire);
+    out->num_places_revealed = atomic_load_explicit(&header->num_places_revealed, memory_order_relaxed);
+    out->flags_placed = atomic_load_explicit(&header->flags_placed, memory_order_relaxed);
+    out->num_mines_flagged = atomic_load_explicit(&header->num_mines_flagged, memory_order_relaxed);
+    out->game_state = atomic_load_explicit(&header->game_state, memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    s2 = atomic_load_explicit(&header->seq, memory_order_relaxed);
+  } while(s1 != s2 || (s1 & 1));
+}
+
+void print_board()
+{
+  for(uint64_t r = 1; r <= header->rows; r++)
+  {
+    for(uint64_t c = 1; c <= header->columns; c++)
+    {
+      uint8_t value = __atomic_load_n(&plane[r * header->stride + c], __ATOMIC_RELAXED);
+      putchar(value < sizeof(cell_chars) - 1 ? cell_chars[value] : '?');
+    }
+    putchar('\n');
+  }
+}